@@ -0,0 +1,463 @@
+
+#include "batch.h"
+#include "editor.h"
+
+#include <pthread.h>
+#include <sys/stat.h>
+
+// Maximum number of edited files held in memory waiting to be written to
+// stdout, per worker thread
+#define JOBS_AHEAD_PER_THREAD 4
+
+typedef enum {
+    OP_INSERT,
+    OP_APPEND,
+    OP_DELETE,
+    OP_ERASE,
+    OP_REPLACE,
+} OpType;
+
+typedef struct {
+    OpType type;
+    int script_line; // For error messages
+    int args[4]; // 1-based line and column numbers
+    char *text, *with; // Point into the script's source
+    int text_len, with_len;
+} Op;
+
+typedef struct {
+    char *path;
+    char *src;
+    Op *ops;
+    int num_ops, max_ops;
+} Script;
+
+typedef struct {
+    char *path;
+    Editor editor;
+    int ok;
+    int done;
+} Job;
+
+typedef struct {
+    Script *script;
+    int in_place;
+    Job *jobs;
+    int num_jobs;
+    int next_job; // Next job for a worker to pick up
+    int num_written; // Jobs the main thread has finished with
+    int max_ahead;
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+} Batch;
+
+
+// ---- Script Parsing --------------------------------------------------------
+
+static char * read_file(char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+    int len = 0, max = 4096;
+    char *buf = malloc(sizeof(char) * max);
+    size_t read;
+    while ((read = fread(&buf[len], sizeof(char), max - len - 1, file)) > 0) {
+        len += (int) read;
+        if (len + 1 >= max) {
+            max *= 2;
+            buf = realloc(buf, sizeof(char) * max);
+        }
+    }
+    fclose(file);
+    buf[len] = '\0';
+    return buf;
+}
+
+static void script_error(Script *s, int script_line, char *msg) {
+    fprintf(stderr, "xi: %s:%d: %s\n", s->path, script_line, msg);
+}
+
+static char * skip_spaces(char *str) {
+    while (*str == ' ' || *str == '\t') {
+        str++;
+    }
+    return str;
+}
+
+static int parse_ints(char **str, int *out, int count) {
+    for (int i = 0; i < count; i++) {
+        char *end;
+        long value = strtol(*str, &end, 10);
+        if (end == *str || value < 1 || value > INT_MAX) {
+            return 0;
+        }
+        out[i] = (int) value;
+        *str = end;
+    }
+    return 1;
+}
+
+static int parse_replace(Op *op, char *args) {
+    char delim = *args;
+    if (delim == '\0') {
+        return 0;
+    }
+    op->text = args + 1;
+    char *end = strchr(op->text, delim);
+    if (!end || end == op->text) { // Missing delimiter or nothing to find
+        return 0;
+    }
+    op->text_len = (int) (end - op->text);
+    op->with = end + 1;
+    end = strchr(op->with, delim);
+    if (!end) {
+        return 0;
+    }
+    op->with_len = (int) (end - op->with);
+    return *skip_spaces(end + 1) == '\0';
+}
+
+static int parse_op(Script *s, Op *op, char *line) {
+    char *args = line;
+    while (*args != '\0' && *args != ' ' && *args != '\t') {
+        args++;
+    }
+    int cmd_len = (int) (args - line);
+    if (*args != '\0') {
+        args++; // Text arguments start after exactly one space
+    }
+    if (cmd_len == 6 && strncmp(line, "insert", 6) == 0) {
+        op->type = OP_INSERT;
+        if (!parse_ints(&args, op->args, 1)) {
+            script_error(s, op->script_line, "expected line number");
+            return 0;
+        }
+        if (*args == ' ') {
+            args++; // Keep any further whitespace as indentation
+        }
+        op->text = args;
+        op->text_len = (int) strlen(args);
+    } else if (cmd_len == 6 && strncmp(line, "append", 6) == 0) {
+        op->type = OP_APPEND;
+        op->text = args;
+        op->text_len = (int) strlen(args);
+    } else if (cmd_len == 6 && strncmp(line, "delete", 6) == 0) {
+        op->type = OP_DELETE;
+        if (!parse_ints(&args, op->args, 1)) {
+            script_error(s, op->script_line, "expected line number");
+            return 0;
+        }
+        op->args[1] = 1;
+        if (*skip_spaces(args) != '\0' &&
+            (!parse_ints(&args, &op->args[1], 1) ||
+             *skip_spaces(args) != '\0')) {
+            script_error(s, op->script_line, "expected line count");
+            return 0;
+        }
+    } else if (cmd_len == 5 && strncmp(line, "erase", 5) == 0) {
+        op->type = OP_ERASE;
+        if (!parse_ints(&args, op->args, 4) || *skip_spaces(args) != '\0') {
+            script_error(s, op->script_line, "expected two line and column "
+                                             "positions");
+            return 0;
+        }
+    } else if (cmd_len == 7 && strncmp(line, "replace", 7) == 0) {
+        op->type = OP_REPLACE;
+        if (!parse_replace(op, skip_spaces(args))) {
+            script_error(s, op->script_line, "expected /find/replace/");
+            return 0;
+        }
+    } else {
+        script_error(s, op->script_line, "unknown command");
+        return 0;
+    }
+    return 1;
+}
+
+static int script_load(Script *s, char *path) {
+    s->path = path;
+    s->num_ops = 0;
+    s->max_ops = 16;
+    s->ops = malloc(sizeof(Op) * s->max_ops);
+    s->src = read_file(path);
+    if (!s->src) {
+        fprintf(stderr, "xi: can't open script '%s'\n", path);
+        return 0;
+    }
+
+    int script_line = 1;
+    for (char *line = s->src; *line != '\0'; script_line++) {
+        char *end = strchr(line, '\n');
+        char *next = end ? end + 1 : line + strlen(line);
+        if (end) {
+            if (end > line && end[-1] == '\r') {
+                end--;
+            }
+            *end = '\0'; // Ops point into the script, so terminate each line
+        }
+        if (*line != '\0' && *line != '#') {
+            if (s->num_ops >= s->max_ops) {
+                s->max_ops *= 2;
+                s->ops = realloc(s->ops, sizeof(Op) * s->max_ops);
+            }
+            Op *op = &s->ops[s->num_ops++];
+            op->script_line = script_line;
+            if (!parse_op(s, op, line)) {
+                return 0;
+            }
+        }
+        line = next;
+    }
+    return 1;
+}
+
+static void script_free(Script *s) {
+    free(s->ops);
+    free(s->src);
+}
+
+
+// ---- Applying Edits --------------------------------------------------------
+
+static int is_valid_pos(Editor *e, int line, int col) {
+    return line <= e->num_lines && col <= e->lines[line - 1]->len + 1;
+}
+
+// An empty file is opened as a single empty line without a new line at the
+// end, which isn't really a line, so line numbers don't count it
+static int is_empty(Editor *e) {
+    return e->num_lines == 1 && e->lines[0]->len == 0 && !e->newline_at_eof;
+}
+
+static int num_lines(Editor *e) {
+    return is_empty(e) ? 0 : e->num_lines;
+}
+
+static void insert_line(Editor *e, int y, Op *op) {
+    if (is_empty(e)) { // Replace the empty line rather than adding to it
+        editor_insert_line(e, 0, op->text, op->text_len);
+        editor_delete_lines(e, 1, 1);
+        e->newline_at_eof = 1;
+    } else {
+        editor_insert_line(e, y, op->text, op->text_len);
+    }
+}
+
+static int apply_op(Editor *e, Op *op) {
+    int *a = op->args;
+    switch (op->type) {
+        case OP_INSERT:
+            if (a[0] > num_lines(e) + 1) {
+                return 0;
+            }
+            insert_line(e, a[0] - 1, op);
+            break;
+        case OP_APPEND:
+            insert_line(e, e->num_lines, op);
+            break;
+        case OP_DELETE:
+            if (a[0] > num_lines(e)) {
+                return 0;
+            }
+            editor_delete_lines(e, a[0] - 1, a[1]);
+            break;
+        case OP_ERASE:
+            if (!is_valid_pos(e, a[0], a[1]) || !is_valid_pos(e, a[2], a[3]) ||
+                a[2] < a[0] || (a[2] == a[0] && a[3] < a[1])) {
+                return 0;
+            }
+            editor_delete(e, a[1] - 1, a[0] - 1, a[3] - 1, a[2] - 1);
+            break;
+        case OP_REPLACE:
+            editor_replace_all(e, op->text, op->text_len,
+                               op->with, op->with_len);
+            break;
+    }
+    return 1;
+}
+
+// Writes the edited file next to the original, then renames it over the top,
+// so a run that's interrupted (or a full disk) never leaves a file truncated
+static int save_in_place(Job *job) {
+    char *path = realpath(job->path, NULL); // Replace a symlink's target
+    if (!path) {
+        return 0;
+    }
+    int len = (int) strlen(path) + 16;
+    char *tmp = malloc(sizeof(char) * len);
+    snprintf(tmp, len, "%s.xi-XXXXXX", path);
+    int fd = mkstemp(tmp);
+    FILE *file = fd != -1 ? fdopen(fd, "w") : NULL;
+    int ok = file != NULL;
+    struct stat info;
+    if (ok && stat(path, &info) == 0) { // Otherwise it'd be private
+        fchmod(fd, info.st_mode & 07777);
+    }
+    ok = ok && editor_write(&job->editor, file);
+    if (file) {
+        ok = fclose(file) == 0 && ok;
+    } else if (fd != -1) {
+        close(fd);
+    }
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok && fd != -1) {
+        unlink(tmp);
+    }
+    free(tmp);
+    free(path);
+    return ok;
+}
+
+static void run_job(Batch *b, Job *job) {
+    if (access(job->path, R_OK) != 0) {
+        fprintf(stderr, "xi: can't open '%s'\n", job->path);
+        job->ok = 0;
+        return;
+    }
+    job->editor = editor_open(job->path);
+    job->ok = 1;
+    Script *s = b->script;
+    for (int i = 0; i < s->num_ops; i++) {
+        if (!apply_op(&job->editor, &s->ops[i])) {
+            fprintf(stderr, "xi: %s: %s:%d: position out of range\n",
+                    job->path, s->path, s->ops[i].script_line);
+            job->ok = 0;
+            break;
+        }
+    }
+    if (b->in_place) { // Write from the worker thread
+        if (job->ok && !save_in_place(job)) {
+            fprintf(stderr, "xi: can't write '%s'\n", job->path);
+            job->ok = 0;
+        }
+        editor_free(&job->editor);
+    } else if (!job->ok) {
+        editor_free(&job->editor);
+    }
+}
+
+static void * worker(void *arg) {
+    Batch *b = arg;
+    pthread_mutex_lock(&b->lock);
+    while (b->next_job < b->num_jobs) {
+        // Don't get too far ahead of the main thread, otherwise we'd end up
+        // holding every edited file in memory at once
+        if (b->next_job >= b->num_written + b->max_ahead) {
+            pthread_cond_wait(&b->changed, &b->lock);
+            continue;
+        }
+        Job *job = &b->jobs[b->next_job++];
+        pthread_mutex_unlock(&b->lock);
+        run_job(b, job);
+        pthread_mutex_lock(&b->lock);
+        job->done = 1;
+        pthread_cond_broadcast(&b->changed);
+    }
+    pthread_mutex_unlock(&b->lock);
+    return NULL;
+}
+
+static int num_threads(int num_jobs) {
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int count = cores < 1 ? 1 : (int) cores;
+    return count < num_jobs ? count : num_jobs;
+}
+
+// With more than one file, each is headed by its path (as 'head' does) and a
+// missing new line at the end is marked (as 'diff' does), so they can be told
+// apart on stdout
+static int write_result(Batch *b, Job *job) {
+    Editor *e = &job->editor;
+    if (b->num_jobs == 1) {
+        return editor_write(e, stdout);
+    }
+    printf("==> %s <==\n", job->path);
+    int ok = editor_write(e, stdout);
+    if (!e->newline_at_eof && !is_empty(e)) {
+        printf("\n\\ No newline at end of file\n");
+    }
+    return ok && !ferror(stdout);
+}
+
+static int run_batch(Batch *b) {
+    int count = num_threads(b->num_jobs);
+    b->max_ahead = count * JOBS_AHEAD_PER_THREAD;
+    pthread_t *threads = malloc(sizeof(pthread_t) * count);
+    for (int i = 0; i < count; i++) {
+        pthread_create(&threads[i], NULL, worker, b);
+    }
+
+    // Stream results out in the order the files were given
+    int ok = 1;
+    for (int i = 0; i < b->num_jobs; i++) {
+        Job *job = &b->jobs[i];
+        pthread_mutex_lock(&b->lock);
+        while (!job->done) {
+            pthread_cond_wait(&b->changed, &b->lock);
+        }
+        pthread_mutex_unlock(&b->lock);
+
+        if (job->ok && !b->in_place) {
+            if (!write_result(b, job)) {
+                job->ok = 0;
+            }
+            editor_free(&job->editor);
+        }
+        ok = ok && job->ok;
+
+        pthread_mutex_lock(&b->lock);
+        b->num_written++;
+        pthread_cond_broadcast(&b->changed);
+        pthread_mutex_unlock(&b->lock);
+    }
+
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+    return ok;
+}
+
+static int usage() {
+    fprintf(stderr, "usage: xi --batch <script> [--in-place] <file>...\n");
+    return 1;
+}
+
+int batch_main(int argc, char *argv[]) {
+    if (argc < 1) {
+        return usage();
+    }
+    Batch b;
+    b.in_place = argc > 1 && strcmp(argv[1], "--in-place") == 0;
+    int first_file = b.in_place ? 2 : 1;
+    if (first_file >= argc) {
+        return usage();
+    }
+
+    Script script;
+    if (!script_load(&script, argv[0])) {
+        script_free(&script);
+        return 1;
+    }
+    b.script = &script;
+    b.num_jobs = argc - first_file;
+    b.jobs = malloc(sizeof(Job) * b.num_jobs);
+    for (int i = 0; i < b.num_jobs; i++) {
+        b.jobs[i].path = argv[first_file + i];
+        b.jobs[i].ok = 0;
+        b.jobs[i].done = 0;
+    }
+    b.next_job = 0;
+    b.num_written = 0;
+    pthread_mutex_init(&b.lock, NULL);
+    pthread_cond_init(&b.changed, NULL);
+
+    int ok = run_batch(&b);
+
+    pthread_cond_destroy(&b.changed);
+    pthread_mutex_destroy(&b.lock);
+    free(b.jobs);
+    script_free(&script);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+
+#ifndef XI_BATCH_H
+#define XI_BATCH_H
+
+// Runs xi without a terminal, applying the edits in a script file to each of
+// the given files. Invoked as:
+//
+//   xi --batch <script> [--in-place] <file>...
+//
+// Edited files are written back to disk with '--in-place' (through a temporary
+// file, so a failed write leaves the original untouched). Otherwise they're
+// written to stdout in the order given; when there's more than one, each is
+// headed by "==> <file> <==", and one without a new line at the end is
+// followed by a new line and "\ No newline at end of file".
+//
+// Each line of the script is one of the following commands (lines and columns
+// are 1-based, and refer to the file as edited so far):
+//
+//   insert <line> <text>    Insert <text> as a new line before <line>
+//   append <text>           Insert <text> as a new line at the end of the file
+//   delete <line> [count]   Delete [count] lines (default 1) from <line>
+//   erase <line> <col> <line> <col>
+//                           Delete the text between two positions
+//   replace /<find>/<with>/ Replace all occurrences of <find> with <with>; the
+//                           first character is used as the delimiter
+//
+// Empty lines and lines starting with '#' are ignored. Files without a new
+// line at the end are written back without one. Returns the process exit code.
+int batch_main(int argc, char *argv[]);
+
+#endif
@@ -0,0 +1,240 @@
+
+#include "config.h"
+#include "json.h"
+#include "keymap.h"
+
+#include <stddef.h>
+
+typedef struct {
+    char *name;
+    int is_flag; // 'int' rather than 'uintattr_t'
+    size_t offset;
+} ThemeField;
+
+#define THEME_COLOR(field) {#field, 0, offsetof(Theme, field)}
+#define THEME_FLAG(field)  {#field, 1, offsetof(Theme, field)}
+
+static ThemeField THEME_FIELDS[] = {
+    THEME_COLOR(text_fg),
+    THEME_COLOR(text_bg),
+    THEME_COLOR(selection_fg),
+    THEME_COLOR(selection_bg),
+    THEME_FLAG(highlight_line),
+    THEME_COLOR(highlight_fg),
+    THEME_COLOR(highlight_bg),
+    THEME_FLAG(show_gutter),
+    THEME_COLOR(gutter_fg),
+    THEME_COLOR(gutter_bg),
+    THEME_FLAG(show_info_bar),
+    THEME_COLOR(info_bar_fg),
+    THEME_COLOR(info_bar_bg),
+    THEME_FLAG(show_scrollbar),
+    THEME_COLOR(scrollbar_bg),
+    THEME_COLOR(scrollbar_thumb_bg),
+    THEME_COLOR(diff_added_fg),
+    THEME_COLOR(diff_removed_fg),
+    THEME_COLOR(diff_changed_fg),
+    {NULL, 0, 0},
+};
+
+typedef struct {
+    char *name;
+    uintattr_t attr;
+} ColorName;
+
+static ColorName COLOR_NAMES[] = {
+    {"default", TB_DEFAULT},
+    {"black", TB_BLACK},
+    {"red", TB_RED},
+    {"green", TB_GREEN},
+    {"yellow", TB_YELLOW},
+    {"blue", TB_BLUE},
+    {"magenta", TB_MAGENTA},
+    {"cyan", TB_CYAN},
+    {"white", TB_WHITE},
+    {"bold", TB_BOLD},
+    {"underline", TB_UNDERLINE},
+    {"reverse", TB_REVERSE},
+    {NULL, 0},
+};
+
+typedef struct {
+    JsonParser json;
+    char *path;
+    Config *config;
+} Loader;
+
+void config_init(Config *c) {
+    c->theme = editor_default_theme();
+    c->soft_wrap = 0;
+    keymap_init(&c->keymap);
+}
+
+int config_path(char *buf, int size, int *must_exist) {
+    char *path = getenv("XI_CONFIG");
+    *must_exist = path != NULL;
+    if (path) {
+        return snprintf(buf, size, "%s", path) < size;
+    }
+    char *home = getenv("HOME");
+    if (!home) {
+        return 0;
+    }
+    return snprintf(buf, size, "%s/.config/xi/config.json", home) < size;
+}
+
+static int config_error(Loader *l, char *msg, char *detail) {
+    if (detail) {
+        fprintf(stderr, "xi: %s:%d: %s '%s'\n",
+                l->path, l->json.line, msg, detail);
+    } else {
+        fprintf(stderr, "xi: %s:%d: %s\n", l->path, l->json.line, msg);
+    }
+    return 0;
+}
+
+static int expect(Loader *l, JsonToken expected, JsonToken tok, char *msg) {
+    if (tok == JSON_ERROR) {
+        return config_error(l, l->json.error, NULL);
+    } else if (tok != expected) {
+        return config_error(l, msg, NULL);
+    }
+    return 1;
+}
+
+// Colors are given as a number, or a name optionally combined with attributes
+// (e.g. "bold red")
+static int parse_color(Loader *l, JsonToken tok, uintattr_t *out) {
+    if (tok == JSON_NUMBER) {
+        double num = l->json.num;
+        if (!(num >= 0 && num < (uintattr_t) -1 + 1.0) || // Also catches NaN
+            num != (uintattr_t) num) {
+            char detail[32];
+            snprintf(detail, sizeof(detail), "%g", num);
+            return config_error(l, "invalid color", detail);
+        }
+        *out = (uintattr_t) num;
+        return 1;
+    } else if (!expect(l, JSON_STRING, tok, "expected color")) {
+        return 0;
+    }
+    uintattr_t attr = 0;
+    for (char *word = strtok(l->json.str, " "); word;
+         word = strtok(NULL, " ")) {
+        ColorName *c = COLOR_NAMES;
+        while (c->name && strcmp(c->name, word) != 0) {
+            c++;
+        }
+        if (!c->name) {
+            return config_error(l, "unknown color", word);
+        }
+        attr |= c->attr;
+    }
+    *out = attr;
+    return 1;
+}
+
+static int parse_theme(Loader *l) {
+    JsonToken tok = json_next(&l->json);
+    if (!expect(l, JSON_OBJECT_START, tok, "expected theme object")) {
+        return 0;
+    }
+    while ((tok = json_next(&l->json)) == JSON_KEY) {
+        ThemeField *f = THEME_FIELDS;
+        while (f->name && strcmp(f->name, l->json.str) != 0) {
+            f++;
+        }
+        if (!f->name) {
+            return config_error(l, "unknown theme option", l->json.str);
+        }
+        char *field = (char *) &l->config->theme + f->offset;
+        tok = json_next(&l->json);
+        if (f->is_flag) {
+            if (tok != JSON_TRUE && tok != JSON_FALSE) {
+                return expect(l, JSON_TRUE, tok, "expected true or false");
+            }
+            *(int *) field = tok == JSON_TRUE;
+        } else if (!parse_color(l, tok, (uintattr_t *) field)) {
+            return 0;
+        }
+    }
+    return expect(l, JSON_OBJECT_END, tok, "expected theme option");
+}
+
+static int parse_keybindings(Loader *l) {
+    JsonToken tok = json_next(&l->json);
+    if (!expect(l, JSON_OBJECT_START, tok, "expected keybindings object")) {
+        return 0;
+    }
+    while ((tok = json_next(&l->json)) == JSON_KEY) {
+        int mod, slot;
+        if (!keymap_parse(l->json.str, &mod, &slot)) {
+            return config_error(l, "invalid key", l->json.str);
+        }
+        tok = json_next(&l->json);
+        if (!expect(l, JSON_STRING, tok, "expected command name")) {
+            return 0;
+        }
+        Command cmd = editor_find_command(l->json.str);
+        if (!cmd) {
+            return config_error(l, "unknown command", l->json.str);
+        }
+        keymap_bind(&l->config->keymap, mod, slot, cmd);
+    }
+    return expect(l, JSON_OBJECT_END, tok, "expected key");
+}
+
+static int parse_config(Loader *l) {
+    JsonToken tok = json_next(&l->json);
+    if (!expect(l, JSON_OBJECT_START, tok, "expected object")) {
+        return 0;
+    }
+    while ((tok = json_next(&l->json)) == JSON_KEY) {
+        if (strcmp(l->json.str, "theme") == 0) {
+            if (!parse_theme(l)) {
+                return 0;
+            }
+        } else if (strcmp(l->json.str, "keybindings") == 0) {
+            if (!parse_keybindings(l)) {
+                return 0;
+            }
+        } else if (strcmp(l->json.str, "soft_wrap") == 0) {
+            tok = json_next(&l->json);
+            if (tok != JSON_TRUE && tok != JSON_FALSE) {
+                return expect(l, JSON_TRUE, tok, "expected true or false");
+            }
+            l->config->soft_wrap = tok == JSON_TRUE;
+        } else {
+            return config_error(l, "unknown option", l->json.str);
+        }
+    }
+    if (!expect(l, JSON_OBJECT_END, tok, "expected option")) {
+        return 0;
+    }
+    return expect(l, JSON_END, json_next(&l->json), "expected end of file");
+}
+
+int config_load(Config *c, char *path, int must_exist) {
+    FILE *file = fopen(path, "r");
+    if (!file && must_exist) {
+        fprintf(stderr, "xi: can't open config file '%s'\n", path);
+        return 0;
+    } else if (!file) { // No config file; stick with the defaults
+        return 1;
+    }
+    Loader l;
+    l.path = path;
+    l.config = c;
+    json_init(&l.json, file);
+    int ok = parse_config(&l);
+    json_free(&l.json);
+    fclose(file);
+    keymap_compile(&c->keymap);
+    return ok;
+}
+
+void config_apply(Config *c, Editor *e) {
+    e->theme = c->theme;
+    e->keymap = &c->keymap;
+    editor_set_soft_wrap(e, c->soft_wrap); // After the theme, which sets width
+}
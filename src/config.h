@@ -0,0 +1,35 @@
+
+#ifndef XI_CONFIG_H
+#define XI_CONFIG_H
+
+#include "editor.h"
+
+// Settings loaded from the JSON config file at startup, e.g.:
+//
+//   {
+//     "soft_wrap": true,
+//     "theme": {"selection_bg": "blue", "gutter_fg": "bold yellow"},
+//     "keybindings": {"ctrl+w": "quit", "alt+z": "toggle_soft_wrap"}
+//   }
+//
+// Anything not given keeps its default.
+typedef struct {
+    Theme theme;
+    int soft_wrap;
+    Keymap keymap;
+} Config;
+
+void config_init(Config *c); // Defaults
+
+// Path of the config file: $XI_CONFIG, or ~/.config/xi/config.json. Returns
+// 0 if there isn't one. Sets 'must_exist' if the path was given explicitly
+int config_path(char *buf, int size, int *must_exist);
+
+// Returns 1 on success, or if the file doesn't exist and 'must_exist' isn't
+// set; otherwise prints an error and returns 0
+int config_load(Config *c, char *path, int must_exist);
+
+// The editor keeps a pointer to the config's keymap, so 'c' must outlive it
+void config_apply(Config *c, Editor *e);
+
+#endif
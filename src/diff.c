@@ -0,0 +1,797 @@
+
+#include "diff.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Myers' algorithm needs O(D^2) memory for D differing lines; beyond this we
+// give up and compare the lines in a range by position instead
+#define MAX_EDITS 2048
+
+// Identical lines in a row needed after an edit before both sides are taken
+// to be back in step
+#define RESYNC_LINES 8
+
+// Lines sampled from each range when looking for anchors, so the lookup table
+// stays small enough to sit in cache however big the file is
+#define MAX_ANCHOR_SAMPLES 4096
+#define SAMPLE_TABLE_SIZE (2 * MAX_ANCHOR_SAMPLES) // At most half full
+#define SAMPLE_FILTER_BITS (16 * MAX_ANCHOR_SAMPLES)
+
+// Ranges are split on anchors at most this many times over
+#define MAX_ANCHOR_DEPTH 32
+
+#define PRIME1 0x9e3779b185ebca87ULL
+#define PRIME2 0xc2b2ae3d27d4eb4fULL
+#define PRIME3 0x165667b19e3779f9ULL
+#define PRIME4 0x85ebca77c2b2ae63ULL
+#define PRIME5 0x27d4eb2f165667c5ULL
+
+typedef struct {
+    int removed; // Otherwise added
+    int x, y; // Position before the edit
+} Edit;
+
+// A line sampled from the disk side, and where it occurs on each side
+typedef struct {
+    uint64_t hash;
+    int a_idx, b_idx;
+    int a_count, b_count;
+} Anchor;
+
+
+// ---- Hashing ---------------------------------------------------------------
+
+static uint64_t rotl(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+// Based on the short input path of xxHash64
+static uint64_t hash_bytes(char *s, int len) {
+    uint64_t h = PRIME5 + (uint64_t) len;
+    int i = 0;
+    for (; i + 8 <= len; i += 8) {
+        uint64_t k;
+        memcpy(&k, &s[i], sizeof(k));
+        k *= PRIME2;
+        k = rotl(k, 31) * PRIME1;
+        h ^= k;
+        h = rotl(h, 27) * PRIME1 + PRIME4;
+    }
+    for (; i < len; i++) {
+        h ^= (unsigned char) s[i] * PRIME5;
+        h = rotl(h, 11) * PRIME1;
+    }
+    h ^= h >> 33;
+    h *= PRIME2;
+    h ^= h >> 29;
+    h *= PRIME3;
+    h ^= h >> 32;
+    return h;
+}
+
+static uint64_t line_hash(Line *line) {
+    if (!line->hashed) { // Reset by the editor whenever the line changes
+        line->hash = hash_bytes(line->s, line->len);
+        line->hashed = 1;
+    }
+    return line->hash;
+}
+
+// Line 'idx' of the file on disk
+static char * disk_line(Diff *d, int idx, int *len) {
+    *len = (int) (d->disk_lines[idx + 1] - d->disk_lines[idx] - 1);
+    return &d->disk[d->disk_lines[idx]];
+}
+
+static uint64_t disk_hash(Diff *d, int idx) {
+    if (d->disk_hashes[idx] == 0) { // Not hashed yet (or really hashes to 0)
+        int len;
+        char *s = disk_line(d, idx, &len);
+        d->disk_hashes[idx] = hash_bytes(s, len);
+    }
+    return d->disk_hashes[idx];
+}
+
+// For the linear scans, where most lines match and are only compared once,
+// so hashing them first would only add work
+static int lines_same(Diff *d, int a, Line *b) {
+    int len;
+    char *s = disk_line(d, a, &len);
+    return len == b->len && memcmp(s, b->s, sizeof(char) * len) == 0;
+}
+
+// For Myers' algorithm, which compares the same lines many times over
+static int lines_equal(Diff *d, int a, Line *b) {
+    int len;
+    char *s = disk_line(d, a, &len);
+    return len == b->len &&
+           disk_hash(d, a) == line_hash(b) &&
+           memcmp(s, b->s, sizeof(char) * len) == 0;
+}
+
+
+// ---- Loading ---------------------------------------------------------------
+
+// The file on disk is only ever read, and only while diffing, so rather than
+// splitting it into a Line each (as 'editor_open' does), it's mapped into
+// memory and only the offset of each line is kept. Lines are split the same
+// way as 'editor_open'
+static void load_disk(Diff *d) {
+    d->disk = NULL;
+    d->disk_size = 0;
+    d->disk_mapped = 0;
+    struct stat info;
+    int file = open(d->buffer->path, O_RDONLY);
+    if (file != -1 && fstat(file, &info) == 0 && info.st_size > 0) {
+        d->disk_size = (long) info.st_size;
+        d->disk = mmap(NULL, d->disk_size, PROT_READ, MAP_PRIVATE, file, 0);
+        d->disk_mapped = d->disk != MAP_FAILED;
+    }
+    if (!d->disk_mapped) { // Read it in instead
+        d->disk = malloc(sizeof(char) * (d->disk_size + 1));
+        long size = 0;
+        ssize_t n;
+        while (file != -1 && size < d->disk_size &&
+               (n = read(file, &d->disk[size], d->disk_size - size)) > 0) {
+            size += n;
+        }
+        d->disk_size = size;
+    }
+    if (file != -1) {
+        close(file);
+    }
+
+    int count = 0, max = d->buffer->num_lines + 2; // Usually about the same
+    long *lines = malloc(sizeof(long) * max);
+    lines[count++] = 0;
+    char *end = d->disk + d->disk_size;
+    for (char *eol = d->disk; (eol = memchr(eol, '\n', end - eol)); eol++) {
+        if (count + 1 >= max) { // Leave room for the end marker below
+            max *= 2;
+            lines = realloc(lines, sizeof(long) * max);
+        }
+        lines[count++] = eol - d->disk + 1; // Start of the next line
+    }
+    if (d->disk_size == 0 || end[-1] != '\n') {
+        // The last line has no new line; pretend it does, so every line's
+        // length is the gap to the next line's start, minus one
+        lines[count++] = d->disk_size + 1;
+    }
+    d->disk_lines = lines;
+    d->num_disk_lines = count - 1; // The last offset only marks the end
+    d->disk_hashes = calloc(d->num_disk_lines, sizeof(uint64_t));
+}
+
+// Copies out the lines on disk in each hunk, which is all that's needed to
+// draw the diff once the rest of the file is unloaded
+static void keep_hunk_lines(Diff *d) {
+    int count = 0;
+    long size = 0;
+    for (int i = 0; i < d->num_hunks; i++) {
+        Hunk *h = &d->hunks[i];
+        h->kept = count;
+        count += h->a_len;
+        long *lines = &d->disk_lines[h->a_start];
+        size += lines[h->a_len] - lines[0];
+    }
+    d->kept = malloc(sizeof(char) * (size + 1));
+    d->kept_lines = malloc(sizeof(long) * (count + 1));
+    long offset = 0;
+    count = 0;
+    for (int i = 0; i < d->num_hunks; i++) {
+        Hunk *h = &d->hunks[i];
+        for (int a = h->a_start; a < h->a_start + h->a_len; a++) {
+            int len;
+            char *s = disk_line(d, a, &len);
+            memcpy(&d->kept[offset], s, sizeof(char) * len);
+            d->kept_lines[count++] = offset;
+            offset += len;
+        }
+    }
+    d->kept_lines[count] = offset;
+}
+
+static void unload_disk(Diff *d) {
+    if (d->disk_mapped) {
+        munmap(d->disk, d->disk_size);
+    } else {
+        free(d->disk);
+    }
+    free(d->disk_lines);
+    free(d->disk_hashes);
+    d->disk = NULL;
+    d->disk_lines = NULL;
+    d->disk_hashes = NULL;
+}
+
+
+// ---- Diffing ---------------------------------------------------------------
+
+// Hunks are always added in order, so a change that follows on directly from
+// the last hunk is merged into it
+static void add_change(Diff *d, int a_start, int a_len,
+                       int b_start, int b_len) {
+    if (a_len == 0 && b_len == 0) {
+        return;
+    }
+    Hunk *last = d->num_hunks > 0 ? &d->hunks[d->num_hunks - 1] : NULL;
+    if (last && a_start == last->a_start + last->a_len &&
+        b_start == last->b_start + last->b_len) {
+        last->a_len += a_len;
+        last->b_len += b_len;
+        return;
+    }
+    if (d->num_hunks >= d->max_hunks) {
+        d->max_hunks *= 2;
+        d->hunks = realloc(d->hunks, sizeof(Hunk) * d->max_hunks);
+    }
+    Hunk *h = &d->hunks[d->num_hunks++];
+    h->a_start = a_start;
+    h->a_len = a_len;
+    h->b_start = b_start;
+    h->b_len = b_len;
+}
+
+// Finds the shortest edit script between the 'n' lines on disk from 'a_lo'
+// and the 'm' lines in the buffer from 'b_lo'. Returns 0 if there are more
+// than 'MAX_EDITS' edits
+static int myers(Diff *d, int a_lo, int n, int b_lo, int m) {
+    Line **b = &d->buffer->lines[b_lo];
+    int max_d = n + m < MAX_EDITS ? n + m : MAX_EDITS;
+    int offset = max_d + 1;
+    int *v = malloc(sizeof(int) * (2 * max_d + 3));
+    v[offset + 1] = 0;
+
+    // The furthest reaching x on each diagonal k in [-d, d] for each d is kept
+    // in 'trace', starting at index d^2, for backtracking
+    int *trace = malloc(sizeof(int) * (max_d + 1) * (max_d + 1));
+    int found = -1;
+    for (int step = 0; step <= max_d && found == -1; step++) {
+        for (int k = -step; k <= step; k += 2) {
+            int x;
+            if (k == -step ||
+                (k != step && v[offset + k - 1] < v[offset + k + 1])) {
+                x = v[offset + k + 1]; // Move down (insertion)
+            } else {
+                x = v[offset + k - 1] + 1; // Move right (deletion)
+            }
+            int y = x - k;
+            while (x < n && y < m && lines_equal(d, a_lo + x, b[y])) {
+                x++; // Follow the diagonal through identical lines
+                y++;
+            }
+            v[offset + k] = x;
+            trace[step * step + k + step] = x;
+            if (x >= n && y >= m) {
+                found = step;
+            }
+        }
+    }
+    free(v);
+    if (found == -1) {
+        free(trace);
+        return 0;
+    }
+
+    // Walk back through the trace to recover the edits, in reverse
+    Edit *edits = malloc(sizeof(Edit) * (found + 1));
+    int x = n, y = m;
+    for (int step = found; step > 0; step--) {
+        int *prev = &trace[(step - 1) * (step - 1) + step - 1]; // Index by k
+        int k = x - y;
+        int prev_k;
+        if (k == -step || (k != step && prev[k - 1] < prev[k + 1])) {
+            prev_k = k + 1;
+        } else {
+            prev_k = k - 1;
+        }
+        int prev_x = prev[prev_k];
+        int prev_y = prev_x - prev_k;
+        Edit *edit = &edits[step - 1];
+        edit->removed = prev_k == k - 1;
+        edit->x = prev_x;
+        edit->y = prev_y;
+        x = prev_x;
+        y = prev_y;
+    }
+    for (int i = 0; i < found; i++) {
+        Edit *edit = &edits[i];
+        add_change(d, edit->x + a_lo, edit->removed,
+                   edit->y + b_lo, !edit->removed);
+    }
+    free(edits);
+    free(trace);
+    return 1;
+}
+
+// Last resort for a range with too many edits for Myers' algorithm: line up
+// both sides and only mark the lines that actually differ
+static void diff_by_position(Diff *d, int a_lo, int a_hi, int b_lo, int b_hi) {
+    int len = a_hi - a_lo < b_hi - b_lo ? a_hi - a_lo : b_hi - b_lo;
+    for (int i = 0; i < len; i++) {
+        if (!lines_same(d, a_lo + i, d->buffer->lines[b_lo + i])) {
+            add_change(d, a_lo + i, 1, b_lo + i, 1);
+        }
+    }
+    add_change(d, a_lo + len, a_hi - a_lo - len, b_lo + len, b_hi - b_lo - len);
+}
+
+// Lines sampled from the disk side while looking for anchors. Most lines
+// scanned weren't sampled, so a bit for each sample's hash rules them out
+// without probing the table
+typedef struct {
+    Anchor *anchors;
+    int count;
+    int table[SAMPLE_TABLE_SIZE]; // Index into 'anchors', or -1 if empty
+    uint64_t filter[SAMPLE_FILTER_BITS / 64];
+} Samples;
+
+static int filter_bit(uint64_t hash) {
+    return (int) (hash >> 32) & (SAMPLE_FILTER_BITS - 1); // Not the table bits
+}
+
+static Anchor * find_sample(Samples *s, uint64_t hash) {
+    int bit = filter_bit(hash);
+    if (!(s->filter[bit / 64] & ((uint64_t) 1 << (bit % 64)))) {
+        return NULL;
+    }
+    int mask = SAMPLE_TABLE_SIZE - 1;
+    for (int i = (int) (hash & mask); s->table[i] != -1; i = (i + 1) & mask) {
+        if (s->anchors[s->table[i]].hash == hash) {
+            return &s->anchors[s->table[i]];
+        }
+    }
+    return NULL;
+}
+
+static void add_sample(Samples *s, uint64_t hash, int a_idx) {
+    int mask = SAMPLE_TABLE_SIZE - 1;
+    int i = (int) (hash & mask);
+    while (s->table[i] != -1) {
+        i = (i + 1) & mask;
+    }
+    s->table[i] = s->count;
+    int bit = filter_bit(hash);
+    s->filter[bit / 64] |= (uint64_t) 1 << (bit % 64);
+    Anchor *anchor = &s->anchors[s->count++];
+    anchor->hash = hash;
+    anchor->a_idx = a_idx;
+    anchor->b_idx = -1;
+    anchor->a_count = 0;
+    anchor->b_count = 0;
+}
+
+// Finds lines that occur exactly once on each side of a range, which are
+// matched up as anchors to split the range on (as in patience diff). Only
+// every few lines on the disk side are considered, so the lookup table stays
+// small however big the range is. The anchors are written to 'anchors' in
+// order on the disk side; returns how many there are
+static int find_anchors(Diff *d, int a_lo, int a_hi, int b_lo, int b_hi,
+                        Anchor *anchors) {
+    Line **b = d->buffer->lines;
+    Samples *s = malloc(sizeof(Samples));
+    s->anchors = anchors;
+    s->count = 0;
+    memset(s->table, -1, sizeof(s->table));
+    memset(s->filter, 0, sizeof(s->filter));
+    int step = (a_hi - a_lo + MAX_ANCHOR_SAMPLES - 1) / MAX_ANCHOR_SAMPLES;
+    for (int i = a_lo; i < a_hi; i += step) {
+        uint64_t hash = disk_hash(d, i);
+        if (!find_sample(s, hash)) { // Otherwise it's not unique anyway
+            add_sample(s, hash, i);
+        }
+    }
+    for (int i = a_lo; i < a_hi; i++) {
+        Anchor *anchor = find_sample(s, disk_hash(d, i));
+        if (anchor) {
+            anchor->a_count++;
+        }
+    }
+    for (int i = b_lo; i < b_hi; i++) {
+        Anchor *anchor = find_sample(s, line_hash(b[i]));
+        if (anchor) {
+            anchor->b_count++;
+            anchor->b_idx = i;
+        }
+    }
+
+    int unique = 0;
+    for (int i = 0; i < s->count; i++) {
+        Anchor *anchor = &anchors[i];
+        if (anchor->a_count == 1 && anchor->b_count == 1 &&
+            lines_equal(d, anchor->a_idx, b[anchor->b_idx])) {
+            anchors[unique++] = *anchor;
+        }
+    }
+    free(s);
+    return unique;
+}
+
+// Keeps the longest run of anchors that are in order on both sides, so they
+// can all be matched at once (patience sorting). Returns how many are kept
+static int longest_chain(Anchor *anchors, int count) {
+    if (count == 0) {
+        return 0;
+    }
+    int *tails = malloc(sizeof(int) * count); // Last anchor of each length
+    int *prev = malloc(sizeof(int) * count);
+    int len = 0;
+    for (int i = 0; i < count; i++) {
+        int lo = 0, hi = len;
+        while (lo < hi) {
+            int mid = lo + (hi - lo) / 2;
+            if (anchors[tails[mid]].b_idx < anchors[i].b_idx) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        prev[i] = lo > 0 ? tails[lo - 1] : -1;
+        tails[lo] = i;
+        if (lo == len) {
+            len++;
+        }
+    }
+    // Gather the chain backwards into 'tails', then copy it over the anchors
+    int i = tails[len - 1];
+    for (int k = len - 1; k >= 0; k--) {
+        tails[k] = i;
+        i = prev[i];
+    }
+    for (int k = 0; k < len; k++) {
+        anchors[k] = anchors[tails[k]];
+    }
+    free(tails);
+    free(prev);
+    return len;
+}
+
+static void diff_range(Diff *d, int a_lo, int a_hi, int b_lo, int b_hi,
+                       int depth) {
+    Line **b = d->buffer->lines;
+
+    // Most lines are usually untouched, so skip the common prefix and suffix
+    // with a cheap linear scan first
+    while (a_lo < a_hi && b_lo < b_hi && lines_same(d, a_lo, b[b_lo])) {
+        a_lo++;
+        b_lo++;
+    }
+    while (a_hi > a_lo && b_hi > b_lo && lines_same(d, a_hi - 1, b[b_hi - 1])) {
+        a_hi--;
+        b_hi--;
+    }
+    if (a_lo == a_hi || b_lo == b_hi) { // Only added or only removed lines
+        add_change(d, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo);
+        return;
+    }
+
+    // Myers' algorithm always finishes on small ranges. Split bigger ones on
+    // lines unique to both sides first, so a few scattered edits in a huge
+    // file don't add up to too many for it
+    int small = a_hi - a_lo + b_hi - b_lo <= MAX_EDITS;
+    if (!small && depth < MAX_ANCHOR_DEPTH) {
+        Anchor *anchors = malloc(sizeof(Anchor) * MAX_ANCHOR_SAMPLES);
+        int count = longest_chain(anchors,
+                                  find_anchors(d, a_lo, a_hi, b_lo, b_hi,
+                                               anchors));
+        for (int i = 0; i < count; i++) {
+            diff_range(d, a_lo, anchors[i].a_idx, b_lo, anchors[i].b_idx,
+                       depth + 1);
+            a_lo = anchors[i].a_idx + 1; // Anchors match, so skip them
+            b_lo = anchors[i].b_idx + 1;
+        }
+        free(anchors);
+        if (count > 0) {
+            diff_range(d, a_lo, a_hi, b_lo, b_hi, depth + 1);
+            return;
+        }
+    }
+    if (!myers(d, a_lo, a_hi - a_lo, b_lo, b_hi - b_lo)) {
+        diff_by_position(d, a_lo, a_hi, b_lo, b_hi);
+    }
+}
+
+// Finds where both sides are back in step after differing at 'a_lo' and
+// 'b_lo': the nearest point (in edits) followed by 'RESYNC_LINES' identical
+// lines, or the end of both ranges. Searches like Myers' algorithm, but
+// without keeping the path, and compares lines with 'lines_same' since most
+// are only compared once. Returns 0 if there are more than 'MAX_EDITS' edits
+static int find_resync(Diff *d, int a_lo, int a_hi, int b_lo, int b_hi,
+                       int *a_sync, int *b_sync) {
+    Line **b = &d->buffer->lines[b_lo];
+    int n = a_hi - a_lo, m = b_hi - b_lo;
+    int max_d = n + m < MAX_EDITS ? n + m : MAX_EDITS;
+    int offset = max_d + 1;
+    int *v = malloc(sizeof(int) * (2 * max_d + 3));
+    v[offset + 1] = 0;
+    for (int step = 0; step <= max_d; step++) {
+        for (int k = -step; k <= step; k += 2) {
+            int x;
+            if (k == -step ||
+                (k != step && v[offset + k - 1] < v[offset + k + 1])) {
+                x = v[offset + k + 1];
+            } else {
+                x = v[offset + k - 1] + 1;
+            }
+            int start = x;
+            while (x < n && x - k < m && x - start < RESYNC_LINES &&
+                   lines_same(d, a_lo + x, b[x - k])) {
+                x++;
+            }
+            v[offset + k] = x;
+            if (x - start >= RESYNC_LINES) {
+                *a_sync = a_lo + start;
+                *b_sync = b_lo + start - k;
+                free(v);
+                return 1;
+            } else if (x >= n && x - k >= m) {
+                *a_sync = a_hi;
+                *b_sync = b_hi;
+                free(v);
+                return 1;
+            }
+        }
+    }
+    free(v);
+    return 0;
+}
+
+// Scans both sides in step, diffing each run of changes on its own as it's
+// found, so that only the lines around them are hashed. Whatever's left once
+// the sides can't be brought back in step is diffed as one range
+static void diff_lines(Diff *d) {
+    Line **b = d->buffer->lines;
+    int a_lo = 0, a_hi = d->num_disk_lines;
+    int b_lo = 0, b_hi = d->buffer->num_lines;
+    if (a_hi + b_hi <= MAX_EDITS) { // Small enough to find the shortest diff
+        diff_range(d, a_lo, a_hi, b_lo, b_hi, 0);
+        return;
+    }
+    while (a_lo < a_hi && b_lo < b_hi) {
+        if (lines_same(d, a_lo, b[b_lo])) {
+            a_lo++;
+            b_lo++;
+            continue;
+        }
+        int a_sync, b_sync;
+        if (!find_resync(d, a_lo, a_hi, b_lo, b_hi, &a_sync, &b_sync)) {
+            break;
+        }
+        diff_range(d, a_lo, a_sync, b_lo, b_sync, 0);
+        a_lo = a_sync;
+        b_lo = b_sync;
+    }
+    diff_range(d, a_lo, a_hi, b_lo, b_hi, 0);
+}
+
+static void compute_rows(Diff *d) {
+    // Each hunk takes up as many rows as its longer side
+    int extra = 0;
+    for (int i = 0; i < d->num_hunks; i++) {
+        Hunk *h = &d->hunks[i];
+        h->row = h->a_start + extra;
+        if (h->b_len > h->a_len) {
+            extra += h->b_len - h->a_len;
+        }
+    }
+    d->num_rows = d->num_disk_lines + extra;
+}
+
+Diff * diff_open(Editor *e) {
+    if (!e->path) {
+        return NULL;
+    }
+    Diff *d = malloc(sizeof(Diff));
+    d->buffer = e;
+    d->num_hunks = 0;
+    d->max_hunks = 16;
+    d->hunks = malloc(sizeof(Hunk) * d->max_hunks);
+    d->scroll = 0;
+    load_disk(d);
+    diff_lines(d);
+    keep_hunk_lines(d);
+    unload_disk(d);
+    compute_rows(d);
+    if (d->num_hunks > 0) { // Start at the first change
+        d->scroll = d->hunks[0].row;
+    }
+    return d;
+}
+
+void diff_free(Diff *d) {
+    free(d->kept);
+    free(d->kept_lines);
+    free(d->hunks);
+    free(d);
+}
+
+// Index of the first hunk starting after 'row', or 'num_hunks' if none
+static int hunk_after(Diff *d, int row) {
+    int lo = 0, hi = d->num_hunks;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (d->hunks[mid].row <= row) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+DiffMark diff_row(Diff *d, int row, int *a, int *b) {
+    int lo = hunk_after(d, row); // Last hunk starting at or before 'row'...
+    if (lo == 0) { // ...unless we're before any hunks
+        *a = row;
+        *b = row;
+        return DIFF_SAME;
+    }
+    Hunk *h = &d->hunks[lo - 1];
+    int i = row - h->row;
+    int rows = h->a_len > h->b_len ? h->a_len : h->b_len;
+    if (i >= rows) { // After the hunk
+        *a = h->a_start + h->a_len + i - rows;
+        *b = h->b_start + h->b_len + i - rows;
+        return DIFF_SAME;
+    }
+    *a = i < h->a_len ? h->a_start + i : -1;
+    *b = i < h->b_len ? h->b_start + i : -1;
+    if (*a == -1) {
+        return DIFF_ADDED;
+    } else if (*b == -1) {
+        return DIFF_REMOVED;
+    }
+    return DIFF_CHANGED;
+}
+
+
+// ---- Drawing ---------------------------------------------------------------
+
+// Line 'a' on disk, which is in the hunk shown on 'row'
+static char * kept_line(Diff *d, int row, int a, int *len) {
+    Hunk *h = &d->hunks[hunk_after(d, row) - 1];
+    long *offsets = &d->kept_lines[h->kept + a - h->a_start];
+    *len = (int) (offsets[1] - offsets[0]);
+    return &d->kept[offsets[0]];
+}
+
+static int num_digits(int num) {
+    int digits = 1;
+    while (num >= 10) {
+        num /= 10;
+        digits++;
+    }
+    return digits;
+}
+
+static void draw_gutter(Diff *d, int line_idx, DiffMark mark,
+                        int x, int y, int digits) {
+    Theme *t = &d->buffer->theme;
+    char num[16] = "";
+    if (line_idx != -1) {
+        snprintf(num, sizeof(num), "%*d", digits, line_idx + 1);
+    }
+    for (int i = 0; i < digits; i++) {
+        char ch = num[i] ? num[i] : ' ';
+        tb_set_cell(x + i, y, ch, t->gutter_fg, t->gutter_bg);
+    }
+    char marker = ' ';
+    uintattr_t fg = t->gutter_fg;
+    if (line_idx != -1) {
+        switch (mark) {
+            case DIFF_SAME: break;
+            case DIFF_ADDED:   marker = '+'; fg = t->diff_added_fg; break;
+            case DIFF_REMOVED: marker = '-'; fg = t->diff_removed_fg; break;
+            case DIFF_CHANGED: marker = '~'; fg = t->diff_changed_fg; break;
+        }
+    }
+    tb_set_cell(x + digits, y, marker, fg, t->gutter_bg);
+    tb_set_cell(x + digits + 1, y, ' ', t->gutter_fg, t->gutter_bg);
+}
+
+// Draws one side of a row; 's' is NULL if there's no line on this side
+static void draw_side(Diff *d, int line_idx, char *s, int len, DiffMark mark,
+                      int x, int width, int y, int digits) {
+    Theme *t = &d->buffer->theme;
+    if (t->show_gutter) {
+        draw_gutter(d, line_idx, mark, x, y, digits);
+        x += digits + 2;
+        width -= digits + 2;
+    }
+    if (!s) {
+        return;
+    }
+    uintattr_t fg = t->text_fg;
+    switch (mark) {
+        case DIFF_SAME: break;
+        case DIFF_ADDED:   fg = t->diff_added_fg; break;
+        case DIFF_REMOVED: fg = t->diff_removed_fg; break;
+        case DIFF_CHANGED: fg = t->diff_changed_fg; break;
+    }
+    for (int i = 0; i < width && i < len; i++) {
+        tb_set_cell(x + i, y, s[i], fg, t->text_bg);
+    }
+}
+
+void diff_draw(Diff *d) {
+    Theme *t = &d->buffer->theme;
+    tb_clear();
+    int width = tb_width();
+    int height = tb_height();
+    int left = (width - 1) / 2; // Disk on the left, buffer on the right
+    int max_lines = d->num_disk_lines > d->buffer->num_lines ?
+                    d->num_disk_lines : d->buffer->num_lines;
+    int digits = num_digits(max_lines);
+    for (int y = 0; y < height && d->scroll + y < d->num_rows; y++) {
+        int a, b, len = 0;
+        DiffMark mark = diff_row(d, d->scroll + y, &a, &b);
+        char *s = NULL;
+        if (mark == DIFF_SAME) { // Only lines in hunks are kept from disk
+            s = d->buffer->lines[b]->s;
+            len = d->buffer->lines[b]->len;
+        } else if (a != -1) {
+            s = kept_line(d, d->scroll + y, a, &len);
+        }
+        draw_side(d, a, s, len, mark, 0, left, y, digits);
+        tb_set_cell(left, y, '|', t->gutter_fg, t->gutter_bg);
+        Line *line = b != -1 ? d->buffer->lines[b] : NULL;
+        draw_side(d, b, line ? line->s : NULL, line ? line->len : 0, mark,
+                  left + 1, width - left - 1, y, digits);
+    }
+    tb_hide_cursor();
+    tb_present();
+}
+
+
+// ---- Navigation ------------------------------------------------------------
+
+static void scroll_to(Diff *d, int row) {
+    if (row > d->num_rows - 1) {
+        row = d->num_rows - 1;
+    }
+    if (row < 0) {
+        row = 0;
+    }
+    d->scroll = row;
+}
+
+static void next_hunk(Diff *d) {
+    int i = hunk_after(d, d->scroll);
+    if (i < d->num_hunks) {
+        scroll_to(d, d->hunks[i].row);
+    }
+}
+
+static void prev_hunk(Diff *d) {
+    int i = hunk_after(d, d->scroll - 1) - 1; // Last hunk before 'scroll'
+    if (i >= 0) {
+        scroll_to(d, d->hunks[i].row);
+    }
+}
+
+void diff_update(Diff *d, struct tb_event ev) {
+    int page = tb_height() - 1;
+    if (ev.type == TB_EVENT_MOUSE) {
+        switch (ev.key) {
+            case TB_KEY_MOUSE_WHEEL_UP:   scroll_to(d, d->scroll - 3); break;
+            case TB_KEY_MOUSE_WHEEL_DOWN: scroll_to(d, d->scroll + 3); break;
+        }
+    } else if (ev.type == TB_EVENT_KEY && ev.key != 0) {
+        switch (ev.key) {
+            case TB_KEY_ARROW_UP:   scroll_to(d, d->scroll - 1); break;
+            case TB_KEY_ARROW_DOWN: scroll_to(d, d->scroll + 1); break;
+            case TB_KEY_PGUP:       scroll_to(d, d->scroll - page); break;
+            case TB_KEY_PGDN:       scroll_to(d, d->scroll + page); break;
+            case TB_KEY_HOME:       scroll_to(d, 0); break;
+            case TB_KEY_END:        scroll_to(d, d->num_rows - 1); break;
+        }
+    } else if (ev.type == TB_EVENT_KEY) {
+        switch (ev.ch) {
+            case 'n': next_hunk(d); break;
+            case 'p': prev_hunk(d); break;
+        }
+    }
+}
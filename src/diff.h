@@ -0,0 +1,60 @@
+
+#ifndef XI_DIFF_H
+#define XI_DIFF_H
+
+#include "editor.h"
+
+typedef enum {
+    DIFF_SAME,
+    DIFF_ADDED, // Only in the buffer
+    DIFF_REMOVED, // Only on disk
+    DIFF_CHANGED, // Different on each side
+} DiffMark;
+
+// A run of lines that differ between the file on disk ('a') and the buffer
+// ('b'). Lines outside of hunks are identical on both sides
+typedef struct {
+    int a_start, a_len;
+    int b_start, b_len;
+    int row; // First row of the hunk in the side-by-side view
+    int kept; // Index of its first line on disk in 'kept_lines'
+} Hunk;
+
+// Compares the buffer with the file on disk. Both are scanned side by side,
+// and where they differ Myers' algorithm finds the nearest point where they
+// line up again; only the lines in between are hashed and diffed. Ranges too
+// different for that are split on lines that occur once on each side (as in
+// patience diff) instead.
+//
+// The file on disk is only needed in full while diffing. Afterwards only the
+// lines in hunks are kept, since every other line is the same in the buffer.
+struct Diff {
+    Editor *buffer;
+    int num_disk_lines;
+
+    // While diffing
+    char *disk; // Contents of the file on disk
+    long disk_size;
+    int disk_mapped; // Otherwise read into memory
+    long *disk_lines; // Offset of each line in 'disk', then one past the end
+    uint64_t *disk_hashes; // Hash of each line, or 0 if not hashed yet
+
+    char *kept; // Lines on disk in each hunk, one after another
+    long *kept_lines; // Offset of each line in 'kept', then one past the end
+    Hunk *hunks;
+    int num_hunks, max_hunks;
+    int num_rows; // In the side-by-side view, where hunks line up
+    int scroll;
+};
+
+Diff * diff_open(Editor *e); // NULL if the buffer hasn't been saved yet
+void diff_free(Diff *d);
+
+// Finds the line on each side for a row of the side-by-side view; either is
+// set to -1 if there's no line on that side
+DiffMark diff_row(Diff *d, int row, int *a, int *b);
+
+void diff_draw(Diff *d);
+void diff_update(Diff *d, struct tb_event ev);
+
+#endif
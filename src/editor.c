@@ -1,16 +1,28 @@
 
 #include "editor.h"
+#include "diff.h"
+#include "keymap.h"
 
 #define WORD_SEPARATORS "./\\()\"'-:,.;<>~!@#$%^&*|+=[]{}`~?"
+#define WHEEL_SCROLL_LINES 3
+#define READ_BLOCK_SIZE (64 * 1024)
+#define WRAP_BLOCK_SIZE 1024 // Lines per block of visual row counts
+
+static Line * alloc_line(int capacity) {
+    Line *line = malloc(sizeof(Line) + sizeof(char) * capacity);
+    line->len = 0;
+    line->max = capacity;
+    line->rows = 1;
+    line->rows_width = -1;
+    line->hashed = 0;
+    return line;
+}
 
 static Line * empty_line() {
-    Line *empty = malloc(sizeof(Line) + sizeof(char) * 16);
-    empty->len = 0;
-    empty->max = 16;
-    return empty;
+    return alloc_line(16);
 }
 
-static Theme default_theme() {
+Theme editor_default_theme() {
     Theme t;
     t.text_fg = TB_DEFAULT;
     t.text_bg = TB_DEFAULT;
@@ -25,6 +37,12 @@ static Theme default_theme() {
     t.show_info_bar = 1;
     t.info_bar_fg = TB_BLUE;
     t.info_bar_bg = TB_DEFAULT;
+    t.show_scrollbar = 1;
+    t.scrollbar_bg = TB_DEFAULT;
+    t.scrollbar_thumb_bg = TB_WHITE;
+    t.diff_added_fg = TB_GREEN;
+    t.diff_removed_fg = TB_RED;
+    t.diff_changed_fg = TB_YELLOW;
     return t;
 }
 
@@ -32,8 +50,12 @@ Editor editor_new() {
     Editor e;
     e.run = 1;
     e.path = NULL;
+    e.newline_at_eof = 1;
     e.scroll_x = 0;
     e.scroll_y = 0;
+    e.scroll_row = 0;
+    e.scroll_pending = 0;
+    e.drag_scrollbar = 0;
     e.cursor_x = 0;
     e.cursor_y = 0;
     e.prev_cursor_x = -1;
@@ -43,7 +65,15 @@ Editor editor_new() {
     e.max_lines = 16;
     e.lines = malloc(sizeof(Line) * e.max_lines);
     e.lines[e.num_lines++] = empty_line();
-    e.theme = default_theme();
+    e.soft_wrap = 0;
+    e.wrap_width = 0;
+    e.wrap_blocks = NULL;
+    e.wrap_tree = NULL;
+    e.max_wrap_blocks = 0;
+    e.wrap_tree_valid = 0;
+    e.theme = editor_default_theme();
+    e.keymap = NULL;
+    e.diff = NULL;
     return e;
 }
 
@@ -77,49 +107,398 @@ static int next_pow2(int num) {
 }
 
 static Line * line_from(char *str, int len) {
-    int capacity = next_pow2(len);
-    if (capacity < 16) {
-        capacity = 16; // Minimum
+    int capacity = 16; // Minimum
+    if (len > capacity) {
+        capacity = next_pow2(len);
     }
-    Line *line = malloc(sizeof(Line) + sizeof(char) * capacity);
+    Line *line = alloc_line(capacity);
     line->len = len;
-    line->max = capacity;
     memcpy(line->s, str, sizeof(char) * len);
     return line;
 }
 
+static void append_line(Editor *e, char *str, int len) {
+    increase_lines_capacity(e, 1);
+    e->lines[e->num_lines++] = line_from(str, len);
+}
+
 Editor editor_open(char *path) {
     Editor e = editor_new();
     e.path = path;
 
-    FILE *file = fopen(path, "r");
+    FILE *file = fopen(path, "rb");
     if (!file) { // File hasn't been created yet
         return e;
     }
+    free(e.lines[0]);
+    e.num_lines = 0;
 
-    char line_buf[256];
-    while (fgets(line_buf, sizeof(line_buf), file)) {
-        int len = (int) strlen(line_buf);
-        increase_line_capacity(&e, e.num_lines - 1, len);
-        Line *line = e.lines[e.num_lines - 1];
-        if (line_buf[len - 1] == '\n' || line_buf[len - 1] == '\r') { // EOL
-            strncpy(&line->s[line->len], line_buf, len - 1); // Skip newline
-            line->len += len - 1;
-            increase_lines_capacity(&e, 1); // Next line
-            e.lines[e.num_lines++] = empty_line();
-        } else { // More line to come
-            strncpy(&line->s[line->len], line_buf, len);
-            line->len += len;
+    // Read in large blocks and split them on new lines, so each line is only
+    // allocated once, at its final size
+    int max = READ_BLOCK_SIZE, len = 0;
+    char *buf = malloc(sizeof(char) * max);
+    size_t read;
+    while ((read = fread(&buf[len], sizeof(char), max - len, file)) > 0) {
+        len += (int) read;
+        char *start = buf;
+        char *end = buf + len;
+        char *eol;
+        while ((eol = memchr(start, '\n', end - start))) {
+            append_line(&e, start, (int) (eol - start));
+            start = eol + 1;
+        }
+        len = (int) (end - start); // Move the partial last line to the front
+        memmove(buf, start, sizeof(char) * len);
+        if (len == max) { // Line is longer than the buffer
+            max *= 2;
+            buf = realloc(buf, sizeof(char) * max);
         }
     }
+    if (len > 0 || e.num_lines == 0) { // No new line at the end of the file
+        append_line(&e, buf, len);
+        e.newline_at_eof = 0;
+    }
+    free(buf);
     fclose(file);
-    e.num_lines--; // Delete the last new line added
     return e;
 }
 
+void editor_free(Editor *e) {
+    if (e->diff) {
+        diff_free(e->diff);
+        e->diff = NULL;
+    }
+    for (int i = 0; i < e->num_lines; i++) {
+        free(e->lines[i]);
+    }
+    free(e->lines);
+    free(e->wrap_blocks);
+    free(e->wrap_tree);
+    e->lines = NULL;
+    e->wrap_blocks = NULL;
+    e->wrap_tree = NULL;
+    e->num_lines = 0;
+}
+
+int editor_write(Editor *e, FILE *out) {
+    for (int i = 0; i < e->num_lines; i++) {
+        Line *line = e->lines[i];
+        fwrite(line->s, sizeof(char), line->len, out);
+        if (i < e->num_lines - 1 || e->newline_at_eof) {
+            fputc('\n', out);
+        }
+    }
+    return !ferror(out);
+}
+
+int editor_save(Editor *e) {
+    if (!e->path) {
+        return 0;
+    }
+    FILE *file = fopen(e->path, "w");
+    if (!file) {
+        return 0;
+    }
+    int ok = editor_write(e, file);
+    return fclose(file) == 0 && ok;
+}
+
+
+// ---- Soft Wrapping ---------------------------------------------------------
+
+// When soft wrapping, each line's row count is cached on the line itself.
+// Lines are grouped into blocks of WRAP_BLOCK_SIZE, and a Fenwick tree over
+// each block's total maps between lines and visual rows in O(log n), plus a
+// walk within one block. Editing a line updates its block in place. Adding or
+// removing a line only moves one line across each later block boundary, so
+// it costs one line per block rather than one per line. Changing the wrap
+// width invalidates every count, and the blocks are only recounted if a jump
+// through the file actually needs them. Drawing and scrolling near the
+// viewport walk the cached counts directly, so they never touch the rest of
+// the file.
+
+static int text_width(Editor *e) {
+    int width = tb_width();
+    return e->theme.show_scrollbar ? width - 1 : width;
+}
+
+static void sync_wrap_width(Editor *e) {
+    int width = text_width(e);
+    if (width < 1) {
+        width = 1;
+    }
+    if (width != e->wrap_width) { // Invalidates every line's cached 'rows'
+        e->wrap_width = width;
+        e->wrap_tree_valid = 0;
+    }
+}
+
+static int wrap_rows(Editor *e, Line *line) {
+    if (line->rows_width != e->wrap_width) {
+        line->rows = line->len / e->wrap_width + 1; // Room for the cursor
+        line->rows_width = e->wrap_width;
+    }
+    return line->rows;
+}
+
+static int num_wrap_blocks(Editor *e) {
+    return (e->num_lines + WRAP_BLOCK_SIZE - 1) / WRAP_BLOCK_SIZE;
+}
+
+static void build_wrap_tree(Editor *e) {
+    int n = num_wrap_blocks(e);
+    int *tree = e->wrap_tree; // 1-based
+    for (int i = 1; i <= n; i++) {
+        tree[i] = e->wrap_blocks[i - 1];
+    }
+    for (int i = 1; i <= n; i++) { // Build in O(n)
+        int parent = i + (i & -i);
+        if (parent <= n) {
+            tree[parent] += tree[i];
+        }
+    }
+}
+
+static void increase_wrap_blocks_capacity(Editor *e) {
+    int n = num_wrap_blocks(e);
+    if (n + 1 > e->max_wrap_blocks) { // Fenwick tree is 1-based
+        e->max_wrap_blocks = next_pow2(n + 1);
+        e->wrap_blocks = realloc(e->wrap_blocks,
+                                 sizeof(int) * e->max_wrap_blocks);
+        e->wrap_tree = realloc(e->wrap_tree, sizeof(int) * e->max_wrap_blocks);
+    }
+}
+
+static void count_wrap_blocks(Editor *e) {
+    increase_wrap_blocks_capacity(e);
+    int n = num_wrap_blocks(e);
+    for (int i = 0; i < n; i++) {
+        e->wrap_blocks[i] = 0;
+    }
+    for (int i = 0; i < e->num_lines; i++) {
+        e->wrap_blocks[i / WRAP_BLOCK_SIZE] += wrap_rows(e, e->lines[i]);
+    }
+    build_wrap_tree(e);
+    e->wrap_tree_valid = 1;
+}
+
+// Number of visual rows before the line 'line_idx'
+static int wrap_row_of(Editor *e, int line_idx) {
+    if (!e->wrap_tree_valid) {
+        count_wrap_blocks(e);
+    }
+    int block = line_idx / WRAP_BLOCK_SIZE;
+    int sum = 0;
+    for (int i = block; i > 0; i -= i & -i) {
+        sum += e->wrap_tree[i];
+    }
+    for (int i = block * WRAP_BLOCK_SIZE; i < line_idx; i++) {
+        sum += wrap_rows(e, e->lines[i]);
+    }
+    return sum;
+}
+
+// Line containing the visual row 'visual_row', and the row within that line
+static int wrap_line_at(Editor *e, int visual_row, int *row) {
+    if (!e->wrap_tree_valid) {
+        count_wrap_blocks(e);
+    }
+    int n = num_wrap_blocks(e);
+    int step = 1;
+    while (step * 2 <= n) {
+        step *= 2;
+    }
+    int block = 0;
+    for (; step > 0; step >>= 1) {
+        int next = block + step;
+        if (next <= n && e->wrap_tree[next] <= visual_row) {
+            block = next;
+            visual_row -= e->wrap_tree[next];
+        }
+    }
+    int line_idx = block * WRAP_BLOCK_SIZE;
+    int rows;
+    while (line_idx < e->num_lines - 1 &&
+           (rows = wrap_rows(e, e->lines[line_idx])) <= visual_row) {
+        visual_row -= rows;
+        line_idx++;
+    }
+    *row = visual_row;
+    return line_idx;
+}
+
+static void add_wrap_rows(Editor *e, int line_idx, int delta) {
+    int block = line_idx / WRAP_BLOCK_SIZE;
+    e->wrap_blocks[block] += delta;
+    for (int i = block + 1; i <= num_wrap_blocks(e); i += i & -i) {
+        e->wrap_tree[i] += delta;
+    }
+}
+
+// Call whenever a line's contents change
+static void line_changed(Editor *e, int line_idx) {
+    Line *line = e->lines[line_idx];
+    line->hashed = 0;
+    int old_rows = line->rows;
+    line->rows_width = -1;
+    if (e->wrap_tree_valid) { // Every line's 'rows' is up to date
+        add_wrap_rows(e, line_idx, wrap_rows(e, line) - old_rows);
+    }
+}
+
+// Call after the line at 'line_idx' is inserted
+static void line_inserted(Editor *e, int line_idx) {
+    if (!e->wrap_tree_valid) {
+        return;
+    }
+    increase_wrap_blocks_capacity(e);
+    int n = num_wrap_blocks(e);
+    if (e->num_lines % WRAP_BLOCK_SIZE == 1) {
+        e->wrap_blocks[n - 1] = 0; // New last block
+    }
+    // Every later block gains the last line of the block before it, and
+    // loses its own last line to the block after it
+    int first = line_idx / WRAP_BLOCK_SIZE;
+    for (int block = first; block < n; block++) {
+        int start = block * WRAP_BLOCK_SIZE;
+        int gained = block == first ? line_idx : start;
+        int lost = start + WRAP_BLOCK_SIZE;
+        e->wrap_blocks[block] += wrap_rows(e, e->lines[gained]);
+        if (lost < e->num_lines) {
+            e->wrap_blocks[block] -= wrap_rows(e, e->lines[lost]);
+        }
+    }
+    build_wrap_tree(e);
+}
+
+// Call after the line at 'line_idx', which had 'rows' rows, is deleted
+static void line_deleted(Editor *e, int line_idx, int rows) {
+    if (!e->wrap_tree_valid) {
+        return;
+    }
+    // The reverse of 'line_inserted'
+    int first = line_idx / WRAP_BLOCK_SIZE;
+    int n = num_wrap_blocks(e);
+    for (int block = first; block < n; block++) {
+        int start = block * WRAP_BLOCK_SIZE;
+        int gained = start + WRAP_BLOCK_SIZE - 1;
+        e->wrap_blocks[block] -= block == first
+                                 ? rows
+                                 : wrap_rows(e, e->lines[start - 1]);
+        if (gained < e->num_lines) {
+            e->wrap_blocks[block] += wrap_rows(e, e->lines[gained]);
+        }
+    }
+    build_wrap_tree(e);
+}
+
+// Call after the lines at 'a' and 'b' swap places
+static void lines_swapped(Editor *e, int a, int b) {
+    if (!e->wrap_tree_valid) {
+        return;
+    }
+    int delta = wrap_rows(e, e->lines[a]) - wrap_rows(e, e->lines[b]);
+    add_wrap_rows(e, a, delta);
+    add_wrap_rows(e, b, -delta);
+}
+
+// Moves a position by 'delta' visual rows, stopping at the start or end of the
+// file; O(|delta|)
+static void walk_rows(Editor *e, int *line_idx, int *row, int delta) {
+    while (delta > 0) {
+        int rows = wrap_rows(e, e->lines[*line_idx]);
+        if (*row + delta < rows) {
+            *row += delta;
+            return;
+        }
+        if (*line_idx >= e->num_lines - 1) {
+            *row = rows - 1; // End of file
+            return;
+        }
+        delta -= rows - *row;
+        (*line_idx)++;
+        *row = 0;
+    }
+    while (delta < 0) {
+        if (*row + delta >= 0) {
+            *row += delta;
+            return;
+        }
+        if (*line_idx == 0) {
+            *row = 0; // Start of file
+            return;
+        }
+        delta += *row + 1;
+        (*line_idx)--;
+        *row = wrap_rows(e, e->lines[*line_idx]) - 1;
+    }
+}
+
+// Visual rows from one position to a later one, counting no further than 'max'
+static int rows_between(Editor *e,
+                        int from_line, int from_row,
+                        int to_line, int to_row,
+                        int max) {
+    int count = -from_row;
+    for (int i = from_line; i < to_line && count < max; i++) {
+        count += wrap_rows(e, e->lines[i]);
+    }
+    count += to_row;
+    return count < max ? count : max;
+}
+
+static void scroll_rows(Editor *e, int delta) {
+    int height = tb_height();
+    if (delta >= -height && delta <= height) { // Walk short distances
+        walk_rows(e, &e->scroll_y, &e->scroll_row, delta);
+        return;
+    }
+    long long target = (long long) wrap_row_of(e, e->scroll_y) +
+                       e->scroll_row + delta;
+    long long total = wrap_row_of(e, e->num_lines);
+    if (target > total - 1) {
+        target = total - 1;
+    }
+    if (target < 0) {
+        target = 0;
+    }
+    e->scroll_y = wrap_line_at(e, (int) target, &e->scroll_row);
+}
+
 
 // ---- Drawing ---------------------------------------------------------------
 
+static void clamp_scroll(Editor *e) {
+    if (e->scroll_y > e->num_lines - 1) {
+        e->scroll_y = e->num_lines - 1;
+    }
+    if (e->scroll_y < 0) {
+        e->scroll_y = 0;
+    }
+    if (!e->soft_wrap) {
+        e->scroll_row = 0;
+    } else {
+        int rows = wrap_rows(e, e->lines[e->scroll_y]);
+        if (e->scroll_row >= rows) { // Line at the top got shorter
+            e->scroll_row = rows - 1;
+        }
+    }
+}
+
+static void flush_scroll(Editor *e) {
+    // Wheel events are accumulated and applied once per frame, so a fast
+    // flick doesn't cost one redraw per wheel tick
+    if (e->soft_wrap) {
+        sync_wrap_width(e);
+        clamp_scroll(e);
+        scroll_rows(e, e->scroll_pending);
+    } else {
+        e->scroll_y += e->scroll_pending;
+    }
+    e->scroll_pending = 0;
+    clamp_scroll(e);
+}
+
 static int has_selection(Editor *e) {
     return e->select_x != -1 && e->select_y != -1;
 }
@@ -174,20 +553,36 @@ static void draw_cursor(Editor *e) {
         tb_hide_cursor(); // Don't draw the cursor in selection mode
         return;
     }
+    int height = tb_height();
     int rel_x = e->cursor_x - e->scroll_x;
     int rel_y = e->cursor_y - e->scroll_y;
+    if (e->soft_wrap) {
+        int row = e->cursor_x / e->wrap_width;
+        rel_x = e->cursor_x % e->wrap_width;
+        if (e->cursor_y < e->scroll_y ||
+            (e->cursor_y == e->scroll_y && row < e->scroll_row)) {
+            rel_y = -1;
+        } else {
+            rel_y = rows_between(e, e->scroll_y, e->scroll_row,
+                                 e->cursor_y, row, height);
+        }
+    }
+    if (rel_y < 0 || rel_y >= height) {
+        tb_hide_cursor(); // Scrolled off screen with the mouse wheel
+        return;
+    }
     tb_set_cursor(rel_x, rel_y);
 }
 
-static void draw_line(Editor *e, int y) {
-    int line_idx = y + e->scroll_y;
+// Draws a line from character 'start' onwards on the screen row 'y'
+static void draw_line(Editor *e, int line_idx, int start, int y) {
     Line *line = e->lines[line_idx];
     if (line->len == 0) {
         return;
     }
-    int width = tb_width();
+    int width = text_width(e);
     for (int x = 0; x < width; x++) {
-        int ch_idx = x + e->scroll_x;
+        int ch_idx = x + start;
         if (ch_idx > line->len) {
             break; // Don't draw beyond the line
         }
@@ -214,14 +609,70 @@ static void draw_line(Editor *e, int y) {
     }
 }
 
-void editor_draw(Editor *e) {
-    tb_clear();
+static void scrollbar_thumb(Editor *e, int *start, int *size) {
+    // Everything is derived from the line count, so this is O(1) no matter
+    // how big the file is. Use 64-bit maths to avoid overflow on huge files
+    int height = tb_height();
+    long long total = (long long) e->num_lines + height - 1;
+    int thumb = (int) ((long long) height * height / total);
+    if (thumb < 1) {
+        thumb = 1;
+    }
+    int max_scroll = e->num_lines > 1 ? e->num_lines - 1 : 1;
+    *start = (int) ((long long) e->scroll_y * (height - thumb) / max_scroll);
+    *size = thumb;
+}
+
+static void draw_scrollbar(Editor *e) {
+    int x = text_width(e);
+    int height = tb_height();
+    int start, size;
+    scrollbar_thumb(e, &start, &size);
+    for (int y = 0; y < height; y++) {
+        int in_thumb = y >= start && y < start + size;
+        uintattr_t bg = in_thumb ? e->theme.scrollbar_thumb_bg
+                                 : e->theme.scrollbar_bg;
+        tb_set_cell(x, y, ' ', e->theme.text_fg, bg);
+    }
+}
+
+static void draw_lines(Editor *e) {
     int height = tb_height();
     for (int y = 0; y < height; y++) {
         if (y + e->scroll_y >= e->num_lines) {
             break; // Last line
         }
-        draw_line(e, y);
+        draw_line(e, y + e->scroll_y, e->scroll_x, y);
+    }
+}
+
+static void draw_wrapped_lines(Editor *e) {
+    int height = tb_height();
+    int line_idx = e->scroll_y;
+    int row = e->scroll_row;
+    for (int y = 0; y < height && line_idx < e->num_lines; y++) {
+        draw_line(e, line_idx, row * e->wrap_width, y);
+        if (++row >= wrap_rows(e, e->lines[line_idx])) {
+            line_idx++;
+            row = 0;
+        }
+    }
+}
+
+void editor_draw(Editor *e) {
+    if (e->diff) {
+        diff_draw(e->diff);
+        return;
+    }
+    flush_scroll(e);
+    tb_clear();
+    if (e->soft_wrap) {
+        draw_wrapped_lines(e);
+    } else {
+        draw_lines(e);
+    }
+    if (e->theme.show_scrollbar) {
+        draw_scrollbar(e);
     }
     draw_cursor(e);
     tb_present();
@@ -235,16 +686,27 @@ static void set_cursor_x(Editor *e, int x) {
     e->prev_cursor_x = -1;
 }
 
-static void correct_horizontal_scroll(Editor *e) {
-    int width = tb_width();
-    if (e->cursor_x >= width + e->scroll_x) {
-        e->scroll_x = e->cursor_x - width + 1;
-    } else if (e->cursor_x < e->scroll_x) {
-        e->scroll_x = e->cursor_x;
+static void correct_wrapped_scroll(Editor *e) {
+    int height = tb_height();
+    int row = e->cursor_x / e->wrap_width;
+    if (e->cursor_y < e->scroll_y ||
+        (e->cursor_y == e->scroll_y && row < e->scroll_row)) {
+        e->scroll_y = e->cursor_y; // Cursor above the screen
+        e->scroll_row = row;
+    } else if (rows_between(e, e->scroll_y, e->scroll_row,
+                            e->cursor_y, row, height) >= height) {
+        // Cursor below the screen; put it on the last row
+        e->scroll_y = e->cursor_y;
+        e->scroll_row = row;
+        walk_rows(e, &e->scroll_y, &e->scroll_row, -(height - 1));
     }
 }
 
 static void correct_vertical_scroll(Editor *e) {
+    if (e->soft_wrap) {
+        correct_wrapped_scroll(e);
+        return;
+    }
     int height = tb_height();
     if (e->cursor_y >= height + e->scroll_y) {
         e->scroll_y = e->cursor_y - height + 1;
@@ -253,20 +715,35 @@ static void correct_vertical_scroll(Editor *e) {
     }
 }
 
+static void correct_horizontal_scroll(Editor *e) {
+    if (e->soft_wrap) { // Wrapped lines are never scrolled sideways
+        return;
+    }
+    int width = text_width(e);
+    if (e->cursor_x >= width + e->scroll_x) {
+        e->scroll_x = e->cursor_x - width + 1;
+    } else if (e->cursor_x < e->scroll_x) {
+        e->scroll_x = e->cursor_x;
+    }
+}
+
+// Called after every movement or edit, so the view follows the cursor even if
+// it was scrolled away with the mouse
 static void correct_scroll(Editor *e) {
+    e->scroll_pending = 0; // Drop wheel ticks not yet drawn
     correct_horizontal_scroll(e);
     correct_vertical_scroll(e);
 }
 
 static void move_start_of_line(Editor *e) {
     set_cursor_x(e, 0);
-    correct_horizontal_scroll(e);
+    correct_scroll(e);
 }
 
 static void move_end_of_line(Editor *e) {
     Line *line = e->lines[e->cursor_y];
     set_cursor_x(e, line->len);
-    correct_horizontal_scroll(e);
+    correct_scroll(e);
 }
 
 static void move_start_of_file(Editor *e) {
@@ -291,7 +768,7 @@ static void move_left(Editor *e) {
         move_end_of_line(e);
     } else {
         set_cursor_x(e, e->cursor_x - 1);
-        correct_horizontal_scroll(e);
+        correct_scroll(e);
     }
 }
 
@@ -305,7 +782,7 @@ static void move_right(Editor *e) {
         move_start_of_line(e);
     } else {
         set_cursor_x(e, e->cursor_x + 1);
-        correct_horizontal_scroll(e);
+        correct_scroll(e);
     }
 }
 
@@ -375,7 +852,7 @@ static int find_prev_word(Editor *e) {
 static void move_prev_word(Editor *e) {
     if (e->cursor_x > 0) {
         set_cursor_x(e, find_prev_word(e));
-        correct_horizontal_scroll(e);
+        correct_scroll(e);
     } else {
         if (e->cursor_y == 0) {
             return; // Start of file
@@ -415,7 +892,7 @@ static void move_next_word(Editor *e) {
     Line *line = e->lines[e->cursor_y];
     if (e->cursor_x < line->len) {
         set_cursor_x(e, find_next_word(e));
-        correct_horizontal_scroll(e);
+        correct_scroll(e);
     } else {
         if (e->cursor_y >= e->num_lines - 1) {
             return; // End of file
@@ -465,14 +942,22 @@ static void check_for_empty_selection(Editor *e) {
 
 // ---- Editing ---------------------------------------------------------------
 
-static void delete_line(Editor *e, int line_idx) {
-    free(e->lines[line_idx]);
-    int remaining = e->num_lines - line_idx - 1;
+static void delete_lines(Editor *e, int line_idx, int count) {
+    int rows = e->lines[line_idx]->rows; // Needed after it's freed
+    for (int i = line_idx; i < line_idx + count; i++) {
+        free(e->lines[i]);
+    }
+    int remaining = e->num_lines - line_idx - count;
     if (remaining > 0) {
         Line **dst = &e->lines[line_idx];
-        memcpy(dst, dst + 1, sizeof(Line *) * remaining);
+        memmove(dst, dst + count, sizeof(Line *) * remaining);
+    }
+    e->num_lines -= count;
+    if (count == 1) {
+        line_deleted(e, line_idx, rows);
+    } else { // Already O(n), so just recount when next needed
+        e->wrap_tree_valid = 0;
     }
-    e->num_lines--;
 }
 
 static void delete_range(Editor *e,
@@ -484,17 +969,14 @@ static void delete_range(Editor *e,
         if (remaining > 0) {
             char *dst = &line->s[min_x];
             char *src = &line->s[max_x];
-            memcpy(dst, src, sizeof(char) * remaining);
+            memmove(dst, src, sizeof(char) * remaining);
         }
         line->len -= max_x - min_x;
+        line_changed(e, min_y);
     } else { // Across multiple lines
         Line *first = e->lines[min_y]; // First line
         first->len = min_x; // Delete to end of line
 
-        for (int y = min_y + 1; y < max_y; y++) { // Lines in between
-            delete_line(e, y);
-        }
-
         Line *last = e->lines[max_y]; // Last line
         int remaining = last->len - max_x;
         increase_line_capacity(e, min_y, remaining);
@@ -506,7 +988,8 @@ static void delete_range(Editor *e,
             memcpy(dst, src, sizeof(char) * remaining);
             first->len += remaining;
         }
-        delete_line(e, max_y);
+        delete_lines(e, min_y + 1, max_y - min_y); // Up to the last line
+        line_changed(e, min_y);
     }
 }
 
@@ -534,7 +1017,7 @@ static void backspace_char(Editor *e) {
     } else { // Middle of line
         delete_range(e, e->cursor_x - 1, e->cursor_y, e->cursor_x, e->cursor_y);
         set_cursor_x(e, e->cursor_x - 1);
-        correct_horizontal_scroll(e);
+        correct_scroll(e);
     }
 }
 
@@ -555,12 +1038,13 @@ static void type_char(Editor *e, char ch) {
     int remaining = line->len - e->cursor_x;
     if (remaining > 0) {
         char *src = &line->s[e->cursor_x];
-        memcpy(src + 1, src, sizeof(char) * remaining);
+        memmove(src + 1, src, sizeof(char) * remaining);
     }
     line->s[e->cursor_x] = ch;
     line->len++;
+    line_changed(e, e->cursor_y);
     set_cursor_x(e, e->cursor_x + 1);
-    correct_horizontal_scroll(e);
+    correct_scroll(e);
 }
 
 static void insert_line(Editor *e, int after_idx, Line *to_insert) {
@@ -568,10 +1052,11 @@ static void insert_line(Editor *e, int after_idx, Line *to_insert) {
     int remaining = e->num_lines - after_idx - 1;
     if (remaining > 0) {
         Line **src = &e->lines[after_idx + 1];
-        memcpy(src + 1, src, sizeof(Line *) * remaining);
+        memmove(src + 1, src, sizeof(Line *) * remaining);
     }
     e->lines[after_idx + 1] = to_insert;
     e->num_lines++;
+    line_inserted(e, after_idx + 1);
 }
 
 static void new_line(Editor *e) {
@@ -587,6 +1072,7 @@ static void new_line(Editor *e) {
         to_insert = empty_line();
     }
     line->len = e->cursor_x;
+    line_changed(e, e->cursor_y);
     insert_line(e, e->cursor_y, to_insert);
     e->cursor_y++;
     set_cursor_x(e, 0);
@@ -601,6 +1087,8 @@ static void shift_line_up(Editor *e) {
     e->lines[e->cursor_y - 1] = e->lines[e->cursor_y];
     e->lines[e->cursor_y] = swap;
     e->cursor_y--;
+    lines_swapped(e, e->cursor_y, e->cursor_y + 1);
+    correct_scroll(e);
 }
 
 static void shift_line_down(Editor *e) {
@@ -611,11 +1099,322 @@ static void shift_line_down(Editor *e) {
     e->lines[e->cursor_y + 1] = e->lines[e->cursor_y];
     e->lines[e->cursor_y] = swap;
     e->cursor_y++;
+    lines_swapped(e, e->cursor_y - 1, e->cursor_y);
+    correct_scroll(e);
+}
+
+
+// ---- Programmatic Editing --------------------------------------------------
+
+// These operate on explicit positions rather than the cursor, and never touch
+// the terminal, so they're safe to use without calling 'tb_init' (e.g. when
+// running in batch mode).
+
+static void clamp_cursor(Editor *e) {
+    if (e->cursor_y >= e->num_lines) {
+        e->cursor_y = e->num_lines - 1;
+    }
+    Line *line = e->lines[e->cursor_y];
+    if (e->cursor_x > line->len) {
+        set_cursor_x(e, line->len);
+    }
+    end_selection(e);
+}
+
+void editor_delete(Editor *e, int min_x, int min_y, int max_x, int max_y) {
+    delete_range(e, min_x, min_y, max_x, max_y);
+    clamp_cursor(e);
+}
+
+void editor_delete_lines(Editor *e, int y, int count) {
+    if (y < 0 || y >= e->num_lines || count <= 0) {
+        return;
+    }
+    if (count > e->num_lines - y) {
+        count = e->num_lines - y;
+    }
+    delete_lines(e, y, count);
+    if (e->num_lines == 0) { // Always keep at least one line
+        insert_line(e, -1, empty_line());
+        e->newline_at_eof = 0; // Nothing left, so write an empty file
+    }
+    clamp_cursor(e);
+}
+
+void editor_insert_line(Editor *e, int y, char *str, int len) {
+    if (y < 0 || y > e->num_lines) {
+        return;
+    }
+    insert_line(e, y - 1, line_from(str, len));
+}
+
+static int find_in_line(Line *line, int from, char *str, int len) {
+    for (int x = from; x + len <= line->len; x++) {
+        if (memcmp(&line->s[x], str, sizeof(char) * len) == 0) {
+            return x;
+        }
+    }
+    return -1;
+}
+
+static int replace_in_line(Editor *e, int line_idx,
+                           char *find, int find_len,
+                           char *with, int with_len) {
+    Line *line = e->lines[line_idx];
+    int count = 0;
+    for (int x = find_in_line(line, 0, find, find_len); x != -1;
+         x = find_in_line(line, x + find_len, find, find_len)) {
+        count++;
+    }
+    if (count == 0) {
+        return 0;
+    }
+
+    // Build the replaced line in one pass, rather than shifting the rest of
+    // the line along for every match
+    int len = line->len + count * (with_len - find_len);
+    Line *out = alloc_line(len < 16 ? 16 : next_pow2(len));
+    int prev = 0;
+    for (int x = find_in_line(line, 0, find, find_len); x != -1;
+         x = find_in_line(line, x + find_len, find, find_len)) {
+        memcpy(&out->s[out->len], &line->s[prev], sizeof(char) * (x - prev));
+        out->len += x - prev;
+        memcpy(&out->s[out->len], with, sizeof(char) * with_len);
+        out->len += with_len;
+        prev = x + find_len;
+    }
+    memcpy(&out->s[out->len], &line->s[prev],
+           sizeof(char) * (line->len - prev));
+    out->len += line->len - prev;
+    out->rows = line->rows;
+    out->rows_width = line->rows_width;
+    free(line);
+    e->lines[line_idx] = out;
+    line_changed(e, line_idx);
+    return count;
+}
+
+int editor_replace_all(Editor *e,
+                       char *find, int find_len,
+                       char *with, int with_len) {
+    if (find_len == 0) {
+        return 0;
+    }
+    int count = 0;
+    for (int y = 0; y < e->num_lines; y++) {
+        count += replace_in_line(e, y, find, find_len, with, with_len);
+    }
+    clamp_cursor(e);
+    return count;
+}
+
+
+// ---- Mouse -----------------------------------------------------------------
+
+static void scroll_to_fraction(Editor *e, int y, int height) {
+    // Jump straight to a percentage of the way through the file; the line
+    // array is indexed directly, so there's nothing to scan
+    if (height <= 1) {
+        return;
+    }
+    if (y < 0) {
+        y = 0;
+    } else if (y > height - 1) {
+        y = height - 1;
+    }
+    e->scroll_y = (int) ((long long) y * (e->num_lines - 1) / (height - 1));
+    e->scroll_row = 0;
+    e->scroll_pending = 0;
+}
+
+static void move_cursor_to_mouse(Editor *e, int x, int y) {
+    int line_idx, ch_idx;
+    if (e->soft_wrap) {
+        int row = e->scroll_row;
+        line_idx = e->scroll_y;
+        walk_rows(e, &line_idx, &row, y < 0 ? 0 : y);
+        if (x >= e->wrap_width) {
+            x = e->wrap_width - 1;
+        }
+        ch_idx = row * e->wrap_width + x;
+    } else {
+        line_idx = y + e->scroll_y;
+        ch_idx = x + e->scroll_x;
+    }
+    if (line_idx >= e->num_lines) {
+        line_idx = e->num_lines - 1;
+    } else if (line_idx < 0) {
+        line_idx = 0;
+    }
+    Line *line = e->lines[line_idx];
+    if (ch_idx > line->len) {
+        ch_idx = line->len;
+    } else if (ch_idx < 0) {
+        ch_idx = 0;
+    }
+    e->cursor_y = line_idx;
+    set_cursor_x(e, ch_idx);
+}
+
+static void mouse_press(Editor *e, struct tb_event ev) {
+    if (e->theme.show_scrollbar && ev.x >= text_width(e)) {
+        e->drag_scrollbar = 1;
+        scroll_to_fraction(e, ev.y, tb_height());
+        return;
+    }
+    end_selection(e);
+    move_cursor_to_mouse(e, ev.x, ev.y);
+}
+
+static void mouse_drag(Editor *e, struct tb_event ev) {
+    if (e->drag_scrollbar) {
+        scroll_to_fraction(e, ev.y, tb_height());
+        return;
+    }
+    start_selection(e); // Anchored where the mouse was pressed
+    move_cursor_to_mouse(e, ev.x, ev.y);
+    correct_scroll(e);
+    check_for_empty_selection(e);
+}
+
+static void handle_mouse(Editor *e, struct tb_event ev) {
+    switch (ev.key) {
+        case TB_KEY_MOUSE_WHEEL_UP:
+            e->scroll_pending -= WHEEL_SCROLL_LINES;
+            return;
+        case TB_KEY_MOUSE_WHEEL_DOWN:
+            e->scroll_pending += WHEEL_SCROLL_LINES;
+            return;
+        case TB_KEY_MOUSE_RELEASE:
+            e->drag_scrollbar = 0;
+            return;
+    }
+    flush_scroll(e); // Mouse position is relative to the scrolled view
+    if (ev.key == TB_KEY_MOUSE_LEFT) {
+        if (ev.mod & TB_MOD_MOTION) {
+            mouse_drag(e, ev);
+        } else {
+            mouse_press(e, ev);
+        }
+    }
+}
+
+
+// ---- Commands --------------------------------------------------------------
+
+static void toggle_soft_wrap(Editor *e) {
+    e->soft_wrap = !e->soft_wrap;
+    if (!e->soft_wrap) {
+        e->wrap_tree_valid = 0; // Not kept up to date while unwrapped
+    }
+    e->scroll_x = 0;
+    e->scroll_row = 0;
+    sync_wrap_width(e);
+    correct_scroll(e);
+}
+
+void editor_set_soft_wrap(Editor *e, int soft_wrap) {
+    if (!soft_wrap != !e->soft_wrap) {
+        toggle_soft_wrap(e);
+    }
+}
+
+static void toggle_diff(Editor *e) {
+    if (e->diff) {
+        diff_free(e->diff);
+        e->diff = NULL;
+    } else {
+        e->diff = diff_open(e);
+    }
+}
+
+static void save(Editor *e) {
+    editor_save(e);
+}
+
+static void quit(Editor *e) {
+    e->run = 0;
+}
+
+typedef struct {
+    char *name;
+    Command fn;
+} NamedCommand;
+
+// Commands that can be bound to keys in the config file
+static NamedCommand COMMANDS[] = {
+    // Movement
+    {"move_left", move_left},
+    {"move_right", move_right},
+    {"move_up", move_up},
+    {"move_down", move_down},
+    {"move_start_of_line", move_start_of_line},
+    {"move_end_of_line", move_end_of_line},
+    {"move_start_of_file", move_start_of_file},
+    {"move_end_of_file", move_end_of_file},
+    {"move_prev_word", move_prev_word},
+    {"move_next_word", move_next_word},
+
+    // Editing
+    {"new_line", new_line},
+    {"backspace", backspace},
+    {"shift_line_up", shift_line_up},
+    {"shift_line_down", shift_line_down},
+
+    // View
+    {"toggle_soft_wrap", toggle_soft_wrap},
+    {"toggle_diff", toggle_diff},
+
+    // File
+    {"save", save},
+    {"quit", quit},
+    {NULL, NULL},
+};
+
+Command editor_find_command(char *name) {
+    for (NamedCommand *cmd = COMMANDS; cmd->name; cmd++) {
+        if (strcmp(cmd->name, name) == 0) {
+            return cmd->fn;
+        }
+    }
+    return NULL;
 }
 
 
 // ---- Event Handling --------------------------------------------------------
 
+static void handle_resize(Editor *e) {
+    // Only the lines we draw get their row counts recomputed straight away;
+    // the rest are recomputed when they're next needed
+    sync_wrap_width(e);
+    clamp_scroll(e);
+    correct_scroll(e);
+}
+
+static Command find_binding(Editor *e, struct tb_event ev) {
+    int slot = keymap_slot(ev.key, ev.key == 0 ? ev.ch : 0);
+    if (!e->keymap || slot == -1) {
+        return NULL;
+    }
+    return e->keymap->commands[ev.mod & KEYMAP_MOD_MASK][slot];
+}
+
+static void handle_diff(Editor *e, struct tb_event ev) {
+    // The diff view is read only, so only closing it or quitting are allowed.
+    // Esc can't be used to close it, since with TB_INPUT_ALT termbox treats
+    // a lone Esc as Alt for the next key
+    Command cmd = ev.type == TB_EVENT_KEY ? find_binding(e, ev) : NULL;
+    if (cmd == toggle_diff || cmd == quit) {
+        cmd(e);
+    } else if (ev.type == TB_EVENT_KEY && ev.key == 0 && ev.ch == 'q') {
+        toggle_diff(e);
+    } else if (ev.type == TB_EVENT_RESIZE) {
+        handle_resize(e); // Keep the editor in sync for when the diff closes
+    } else {
+        diff_update(e->diff, ev);
+    }
+}
+
 static void handle_key(Editor *e, struct tb_event ev) {
     if (ev.mod & TB_MOD_SHIFT) { // Start selection
         switch (ev.key) {
@@ -633,54 +1432,34 @@ static void handle_key(Editor *e, struct tb_event ev) {
         }
     }
 
-    if (ev.mod & TB_MOD_CTRL) { // Ctrl takes precedence over alt
-        switch (ev.key) {
-            // Movement
-            case TB_KEY_ARROW_LEFT:  move_start_of_line(e); return;
-            case TB_KEY_ARROW_RIGHT: move_end_of_line(e); return;
-            case TB_KEY_ARROW_UP:    move_start_of_file(e); return;
-            case TB_KEY_ARROW_DOWN:  move_end_of_file(e); return;
-        }
-    } else if (ev.mod & TB_MOD_ALT) {
-         switch (ev.key) {
-             // Movement
-             case TB_KEY_ARROW_LEFT:  move_prev_word(e); return;
-             case TB_KEY_ARROW_RIGHT: move_next_word(e); return;
-
-             // Editing
-             case TB_KEY_ARROW_UP:   shift_line_up(e); return;
-             case TB_KEY_ARROW_DOWN: shift_line_down(e); return;
-         }
-    } // Otherwise, fall through to the non-modifier command...
-
-    switch (ev.key) {
-        // Movement
-        case TB_KEY_ARROW_LEFT:  move_left(e); break;
-        case TB_KEY_ARROW_RIGHT: move_right(e); break;
-        case TB_KEY_ARROW_UP:    move_up(e); break;
-        case TB_KEY_ARROW_DOWN:  move_down(e); break;
-
-        // Editing
-        case TB_KEY_ENTER:      new_line(e); break;
-        case TB_KEY_BACKSPACE:
-        case TB_KEY_BACKSPACE2: backspace(e); break;
-
-        // Quit
-        case TB_KEY_CTRL_Q: e->run = 0; break;
+    Command cmd = find_binding(e, ev);
+    if (cmd) {
+        cmd(e);
     }
     check_for_empty_selection(e);
 }
 
 static void handle_char(Editor *e, struct tb_event ev) {
-    if (ev.ch < 256) { // ASCII support only for now
+    Command cmd = find_binding(e, ev);
+    if (cmd) { // Bound to a command, e.g. alt+z
+        cmd(e);
+    } else if (ev.ch < 256) { // ASCII support only for now
         type_char(e, (char) ev.ch);
     }
 }
 
 void editor_update(Editor *e, struct tb_event ev) {
+    if (e->diff) {
+        handle_diff(e, ev);
+        return;
+    }
     if (ev.type == TB_EVENT_KEY && ev.key != 0) {
         handle_key(e, ev);
     } else if (ev.type == TB_EVENT_KEY && ev.ch != 0) {
         handle_char(e, ev);
+    } else if (ev.type == TB_EVENT_MOUSE) {
+        handle_mouse(e, ev);
+    } else if (ev.type == TB_EVENT_RESIZE) {
+        handle_resize(e);
     }
 }
\ No newline at end of file
@@ -18,28 +18,78 @@ typedef struct {
     int show_info_bar;
     uintattr_t info_bar_fg;
     uintattr_t info_bar_bg;
+    int show_scrollbar;
+    uintattr_t scrollbar_bg;
+    uintattr_t scrollbar_thumb_bg;
+    uintattr_t diff_added_fg;
+    uintattr_t diff_removed_fg;
+    uintattr_t diff_changed_fg;
 } Theme;
 
 typedef struct {
     int len, max;
+    int rows; // Cached number of rows when soft wrapped...
+    int rows_width; // ...valid only if this matches the editor's 'wrap_width'
+    uint64_t hash; // Cached for diffing, valid only if 'hashed' is set
+    int hashed;
     char s[];
 } Line;
 
+typedef struct Editor Editor;
+typedef struct Diff Diff;
+typedef void (*Command)(Editor *e);
+
+// Key bindings are compiled into a flat table indexed by modifiers and key,
+// so dispatching a key press is a single lookup (see 'keymap.h')
+#define KEYMAP_MODS 8 // Every combination of alt, ctrl and shift
+#define KEYMAP_SLOTS 384
+
 typedef struct {
+    Command bindings[KEYMAP_MODS][KEYMAP_SLOTS]; // Explicitly bound
+    Command commands[KEYMAP_MODS][KEYMAP_SLOTS]; // Compiled, with fallbacks
+} Keymap;
+
+struct Editor {
     int run;
     char *path; // File we're editing, or NULL if it hasn't been saved yet
+    int newline_at_eof; // Last line ends with a new line when written
     int scroll_x, scroll_y;
+    int scroll_row; // First visible row of line 'scroll_y' when soft wrapped
+    int scroll_pending; // Mouse wheel rows not yet applied to the scroll
+    int drag_scrollbar; // Mouse was pressed on the scrollbar
     int cursor_x, cursor_y; // Absolute position within 'lines'
     int prev_cursor_x; // Used when moving cursor up/down lines
     int select_x, select_y;
     Line **lines;
     int num_lines, max_lines;
+    int soft_wrap;
+    int wrap_width;
+    int *wrap_blocks; // Total 'rows' of each block of lines
+    int *wrap_tree; // Fenwick tree over 'wrap_blocks', for prefix sums
+    int max_wrap_blocks;
+    int wrap_tree_valid; // Recounted lazily after the wrap width changes
     Theme theme;
-} Editor;
+    Keymap *keymap;
+    Diff *diff; // Open diff view against the file on disk, or NULL
+};
 
+Theme editor_default_theme();
 Editor editor_new();
 Editor editor_open(char *path);
+void editor_free(Editor *e);
+int editor_write(Editor *e, FILE *out); // Returns 1 on success
+int editor_save(Editor *e); // Writes back to 'path'; returns 1 on success
 void editor_draw(Editor *e);
 void editor_update(Editor *e, struct tb_event ev);
+void editor_set_soft_wrap(Editor *e, int soft_wrap);
+Command editor_find_command(char *name); // NULL if there's no such command
+
+// Positions are 0-based; 'y' is the line to insert before
+void editor_delete(Editor *e, int min_x, int min_y, int max_x, int max_y);
+void editor_delete_lines(Editor *e, int y, int count);
+void editor_insert_line(Editor *e, int y, char *str, int len);
+int editor_replace_all(Editor *e,
+                       char *find, int find_len,
+                       char *with, int with_len);
 
 #endif
@@ -0,0 +1,279 @@
+
+#include "json.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+enum {
+    STATE_VALUE,
+    STATE_VALUE_OR_END, // Just after '['
+    STATE_KEY,
+    STATE_KEY_OR_END, // Just after '{'
+    STATE_AFTER_VALUE,
+    STATE_DONE,
+    STATE_ERROR,
+};
+
+void json_init(JsonParser *p, FILE *in) {
+    p->in = in;
+    p->line = 1;
+    p->error = NULL;
+    p->str_len = 0;
+    p->str_max = 64;
+    p->str = malloc(sizeof(char) * p->str_max);
+    p->str[0] = '\0';
+    p->num = 0;
+    p->depth = 0;
+    p->state = STATE_VALUE;
+}
+
+void json_free(JsonParser *p) {
+    free(p->str);
+    p->str = NULL;
+}
+
+static JsonToken error(JsonParser *p, char *msg) {
+    p->error = msg;
+    p->state = STATE_ERROR;
+    return JSON_ERROR;
+}
+
+static int next_char(JsonParser *p) {
+    int c = getc(p->in);
+    if (c == '\n') {
+        p->line++;
+    }
+    return c;
+}
+
+static void unread_char(JsonParser *p, int c) {
+    if (c == EOF) {
+        return;
+    }
+    if (c == '\n') {
+        p->line--;
+    }
+    ungetc(c, p->in);
+}
+
+static int skip_whitespace(JsonParser *p) {
+    int c;
+    do {
+        c = next_char(p);
+    } while (c == ' ' || c == '\t' || c == '\n' || c == '\r');
+    return c;
+}
+
+static void push_char(JsonParser *p, char c) {
+    if (p->str_len + 1 >= p->str_max) { // Leave room for the NUL
+        p->str_max *= 2;
+        p->str = realloc(p->str, sizeof(char) * p->str_max);
+    }
+    p->str[p->str_len++] = c;
+    p->str[p->str_len] = '\0';
+}
+
+static void push_utf8(JsonParser *p, unsigned int cp) {
+    if (cp < 0x80) {
+        push_char(p, (char) cp);
+    } else if (cp < 0x800) {
+        push_char(p, (char) (0xc0 | (cp >> 6)));
+        push_char(p, (char) (0x80 | (cp & 0x3f)));
+    } else {
+        push_char(p, (char) (0xe0 | (cp >> 12)));
+        push_char(p, (char) (0x80 | ((cp >> 6) & 0x3f)));
+        push_char(p, (char) (0x80 | (cp & 0x3f)));
+    }
+}
+
+static int read_hex4(JsonParser *p, unsigned int *out) {
+    *out = 0;
+    for (int i = 0; i < 4; i++) {
+        int c = next_char(p);
+        *out <<= 4;
+        if (c >= '0' && c <= '9') {
+            *out |= c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            *out |= c - 'a' + 10;
+        } else if (c >= 'A' && c <= 'F') {
+            *out |= c - 'A' + 10;
+        } else {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Reads a string after its opening quote into 'str'
+static int read_string(JsonParser *p) {
+    p->str_len = 0;
+    p->str[0] = '\0';
+    while (1) {
+        int c = next_char(p);
+        if (c == '"') {
+            return 1;
+        } else if (c == EOF || c == '\n') {
+            error(p, "unterminated string");
+            return 0;
+        } else if (c < 0x20 && c >= 0) {
+            error(p, "control character in string");
+            return 0;
+        } else if (c != '\\') {
+            push_char(p, (char) c);
+            continue;
+        }
+        c = next_char(p); // Escape sequence
+        unsigned int cp;
+        switch (c) {
+            case '"':  push_char(p, '"'); break;
+            case '\\': push_char(p, '\\'); break;
+            case '/':  push_char(p, '/'); break;
+            case 'b':  push_char(p, '\b'); break;
+            case 'f':  push_char(p, '\f'); break;
+            case 'n':  push_char(p, '\n'); break;
+            case 'r':  push_char(p, '\r'); break;
+            case 't':  push_char(p, '\t'); break;
+            case 'u':
+                if (!read_hex4(p, &cp)) {
+                    error(p, "invalid unicode escape");
+                    return 0;
+                }
+                push_utf8(p, cp);
+                break;
+            default:
+                error(p, "invalid escape sequence");
+                return 0;
+        }
+    }
+}
+
+static JsonToken read_number(JsonParser *p, int c) {
+    p->str_len = 0;
+    while ((c >= '0' && c <= '9') || c == '-' || c == '+' ||
+           c == '.' || c == 'e' || c == 'E') {
+        push_char(p, (char) c);
+        c = next_char(p);
+    }
+    unread_char(p, c);
+    char *end;
+    p->num = strtod(p->str, &end);
+    if (*end != '\0') {
+        return error(p, "invalid number");
+    }
+    p->state = STATE_AFTER_VALUE;
+    return JSON_NUMBER;
+}
+
+static JsonToken read_literal(JsonParser *p, int c) {
+    p->str_len = 0;
+    while (c >= 'a' && c <= 'z') {
+        push_char(p, (char) c);
+        c = next_char(p);
+    }
+    unread_char(p, c);
+    p->state = STATE_AFTER_VALUE;
+    if (strcmp(p->str, "true") == 0) {
+        return JSON_TRUE;
+    } else if (strcmp(p->str, "false") == 0) {
+        return JSON_FALSE;
+    } else if (strcmp(p->str, "null") == 0) {
+        return JSON_NULL;
+    }
+    return error(p, "unexpected identifier");
+}
+
+static JsonToken open_container(JsonParser *p, char c) {
+    if (p->depth >= JSON_MAX_DEPTH) {
+        return error(p, "too deeply nested");
+    }
+    p->stack[p->depth++] = c;
+    if (c == '{') {
+        p->state = STATE_KEY_OR_END;
+        return JSON_OBJECT_START;
+    } else {
+        p->state = STATE_VALUE_OR_END;
+        return JSON_ARRAY_START;
+    }
+}
+
+static JsonToken close_container(JsonParser *p, int c) {
+    char open = c == '}' ? '{' : '[';
+    if (p->depth == 0 || p->stack[p->depth - 1] != open) {
+        return error(p, "mismatched brackets");
+    }
+    p->depth--;
+    p->state = STATE_AFTER_VALUE;
+    return c == '}' ? JSON_OBJECT_END : JSON_ARRAY_END;
+}
+
+static JsonToken read_value(JsonParser *p, int c) {
+    if (c == '{' || c == '[') {
+        return open_container(p, (char) c);
+    } else if (c == '"') {
+        if (!read_string(p)) {
+            return JSON_ERROR;
+        }
+        p->state = STATE_AFTER_VALUE;
+        return JSON_STRING;
+    } else if (c == '-' || (c >= '0' && c <= '9')) {
+        return read_number(p, c);
+    } else if (c >= 'a' && c <= 'z') {
+        return read_literal(p, c);
+    } else if (c == EOF) {
+        return error(p, "unexpected end of file");
+    }
+    return error(p, "unexpected character");
+}
+
+JsonToken json_next(JsonParser *p) {
+    if (p->state == STATE_ERROR) {
+        return JSON_ERROR;
+    } else if (p->state == STATE_DONE) {
+        return JSON_END;
+    }
+    int c = skip_whitespace(p);
+    switch (p->state) {
+        case STATE_AFTER_VALUE:
+            if (p->depth == 0) { // Finished the top level value
+                if (c != EOF) {
+                    return error(p, "expected end of file");
+                }
+                p->state = STATE_DONE;
+                return JSON_END;
+            } else if (c == '}' || c == ']') {
+                return close_container(p, c);
+            } else if (c != ',') {
+                return error(p, "expected ','");
+            }
+            c = skip_whitespace(p);
+            p->state = p->stack[p->depth - 1] == '{' ? STATE_KEY : STATE_VALUE;
+            break;
+        case STATE_KEY_OR_END:
+            if (c == '}') {
+                return close_container(p, c);
+            }
+            p->state = STATE_KEY;
+            break;
+        case STATE_VALUE_OR_END:
+            if (c == ']') {
+                return close_container(p, c);
+            }
+            p->state = STATE_VALUE;
+            break;
+    }
+
+    if (p->state == STATE_KEY) {
+        if (c != '"') {
+            return error(p, "expected key");
+        }
+        if (!read_string(p)) {
+            return JSON_ERROR;
+        }
+        if (skip_whitespace(p) != ':') {
+            return error(p, "expected ':'");
+        }
+        p->state = STATE_VALUE;
+        return JSON_KEY;
+    }
+    return read_value(p, c);
+}
@@ -0,0 +1,44 @@
+
+#ifndef XI_JSON_H
+#define XI_JSON_H
+
+#include <stdio.h>
+
+#define JSON_MAX_DEPTH 32
+
+typedef enum {
+    JSON_ERROR,
+    JSON_END, // End of the input
+    JSON_OBJECT_START,
+    JSON_OBJECT_END,
+    JSON_ARRAY_START,
+    JSON_ARRAY_END,
+    JSON_KEY, // Object key; contents in 'str'
+    JSON_STRING, // Contents in 'str'
+    JSON_NUMBER, // Value in 'num'
+    JSON_TRUE,
+    JSON_FALSE,
+    JSON_NULL,
+} JsonToken;
+
+// Streaming (pull) JSON parser. Reads one token at a time straight from a
+// file, without building up a tree of the whole document. Each call to
+// 'json_next' validates the token against the surrounding structure, so
+// callers only need to handle the tokens they expect.
+typedef struct {
+    FILE *in;
+    int line; // For error messages
+    char *error; // Set when 'json_next' returns JSON_ERROR
+    char *str; // Contents of the last key or string, NUL terminated
+    int str_len, str_max;
+    double num;
+    char stack[JSON_MAX_DEPTH]; // '{' or '[' for each enclosing container
+    int depth;
+    int state;
+} JsonParser;
+
+void json_init(JsonParser *p, FILE *in);
+void json_free(JsonParser *p);
+JsonToken json_next(JsonParser *p);
+
+#endif
@@ -0,0 +1,159 @@
+
+#include "keymap.h"
+
+typedef struct {
+    char *combo;
+    char *command;
+} Binding;
+
+static Binding DEFAULT_BINDINGS[] = {
+    // Movement
+    {"left", "move_left"},
+    {"right", "move_right"},
+    {"up", "move_up"},
+    {"down", "move_down"},
+    {"ctrl+left", "move_start_of_line"},
+    {"ctrl+right", "move_end_of_line"},
+    {"ctrl+up", "move_start_of_file"},
+    {"ctrl+down", "move_end_of_file"},
+    {"alt+left", "move_prev_word"},
+    {"alt+right", "move_next_word"},
+
+    // Editing
+    {"alt+up", "shift_line_up"},
+    {"alt+down", "shift_line_down"},
+    {"enter", "new_line"},
+    {"backspace", "backspace"},
+    {"ctrl+h", "backspace"}, // Some terminals send this for backspace
+
+    // View
+    {"alt+z", "toggle_soft_wrap"},
+    {"ctrl+d", "toggle_diff"},
+
+    // File
+    {"ctrl+s", "save"},
+    {"ctrl+q", "quit"},
+    {NULL, NULL},
+};
+
+typedef struct {
+    char *name;
+    uint16_t key;
+} KeyName;
+
+static KeyName KEY_NAMES[] = {
+    {"left", TB_KEY_ARROW_LEFT},
+    {"right", TB_KEY_ARROW_RIGHT},
+    {"up", TB_KEY_ARROW_UP},
+    {"down", TB_KEY_ARROW_DOWN},
+    {"home", TB_KEY_HOME},
+    {"end", TB_KEY_END},
+    {"pgup", TB_KEY_PGUP},
+    {"pgdn", TB_KEY_PGDN},
+    {"insert", TB_KEY_INSERT},
+    {"delete", TB_KEY_DELETE},
+    {"enter", TB_KEY_ENTER},
+    {"tab", TB_KEY_TAB},
+    {"backspace", TB_KEY_BACKSPACE2},
+    {"f1", TB_KEY_F1},
+    {"f2", TB_KEY_F1 - 1},
+    {"f3", TB_KEY_F1 - 2},
+    {"f4", TB_KEY_F1 - 3},
+    {"f5", TB_KEY_F1 - 4},
+    {"f6", TB_KEY_F1 - 5},
+    {"f7", TB_KEY_F1 - 6},
+    {"f8", TB_KEY_F1 - 7},
+    {"f9", TB_KEY_F1 - 8},
+    {"f10", TB_KEY_F1 - 9},
+    {"f11", TB_KEY_F1 - 10},
+    {"f12", TB_KEY_F1 - 11},
+    {NULL, 0},
+};
+
+void keymap_init(Keymap *k) {
+    memset(k, 0, sizeof(Keymap));
+    for (Binding *b = DEFAULT_BINDINGS; b->combo; b++) {
+        int mod, slot;
+        keymap_parse(b->combo, &mod, &slot);
+        keymap_bind(k, mod, slot, editor_find_command(b->command));
+    }
+    keymap_compile(k);
+}
+
+// Termbox only reports ctrl and shift for special keys like the arrows.
+// Characters and control keys (like enter) are sent as a single byte, so
+// combinations termbox could never report are rejected rather than bound
+static int parse_key(char *name, int len, int *mod, int *slot) {
+    if (len == 1 && name[0] > ' ' && name[0] < 127) { // Single character
+        char ch = name[0];
+        if (*mod & TB_MOD_SHIFT) { // Arrives as another character (e.g. 'A')
+            return 0;
+        }
+        if (*mod & TB_MOD_CTRL) { // Control keys have their own key codes
+            if (ch < 'a' || ch > 'z') {
+                return 0;
+            }
+            *slot = keymap_slot(0x01 + ch - 'a', 0); // TB_KEY_CTRL_A onwards
+            *mod &= ~TB_MOD_CTRL; // Implied by the key code
+        } else {
+            *slot = keymap_slot(0, (uint32_t) ch);
+        }
+        return 1;
+    }
+    for (KeyName *k = KEY_NAMES; k->name; k++) {
+        if ((int) strlen(k->name) == len && strncmp(k->name, name, len) == 0) {
+            if (k->key < 128 && (*mod & (TB_MOD_CTRL | TB_MOD_SHIFT))) {
+                return 0; // A control key, so no ctrl or shift
+            }
+            *slot = keymap_slot(k->key, 0);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int keymap_parse(char *combo, int *mod, int *slot) {
+    *mod = 0;
+    while (1) {
+        char *plus = strchr(combo, '+');
+        if (!plus || plus[1] == '\0') { // Last part is the key (maybe '+')
+            break;
+        }
+        int len = (int) (plus - combo);
+        if (len == 4 && strncmp(combo, "ctrl", 4) == 0) {
+            *mod |= TB_MOD_CTRL;
+        } else if (len == 3 && strncmp(combo, "alt", 3) == 0) {
+            *mod |= TB_MOD_ALT;
+        } else if (len == 5 && strncmp(combo, "shift", 5) == 0) {
+            *mod |= TB_MOD_SHIFT;
+        } else {
+            return 0;
+        }
+        combo = plus + 1;
+    }
+    return parse_key(combo, (int) strlen(combo), mod, slot);
+}
+
+void keymap_bind(Keymap *k, int mod, int slot, Command cmd) {
+    k->bindings[mod & KEYMAP_MOD_MASK][slot] = cmd;
+}
+
+void keymap_compile(Keymap *k) {
+    // Unbound combinations fall back to fewer modifiers: first ignore shift
+    // (which only extends the selection for movement), then ctrl takes
+    // precedence over alt, and finally the key with no modifiers
+    for (int mod = 0; mod < KEYMAP_MODS; mod++) {
+        int fallbacks[4];
+        fallbacks[0] = mod;
+        fallbacks[1] = mod & ~TB_MOD_SHIFT;
+        fallbacks[2] = (mod & TB_MOD_CTRL) ? TB_MOD_CTRL : mod & TB_MOD_ALT;
+        fallbacks[3] = 0;
+        for (int slot = 0; slot < KEYMAP_SLOTS; slot++) {
+            Command cmd = NULL;
+            for (int i = 0; i < 4 && !cmd; i++) {
+                cmd = k->bindings[fallbacks[i]][slot];
+            }
+            k->commands[mod][slot] = cmd;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+
+#ifndef XI_KEYMAP_H
+#define XI_KEYMAP_H
+
+#include "editor.h"
+
+// Modifiers index the first dimension of the keymap's tables directly
+#define KEYMAP_MOD_MASK (TB_MOD_ALT | TB_MOD_CTRL | TB_MOD_SHIFT)
+
+// Slot in the keymap's tables for a termbox key or character:
+// * 0-127: control keys (e.g. TB_KEY_ENTER, TB_KEY_CTRL_Q)
+// * 128-255: special keys, which count down from 0xffff (e.g. TB_KEY_F1)
+// * 256-383: ASCII characters (e.g. for 'alt+z')
+// Returns -1 if the key can't be bound.
+static inline int keymap_slot(uint16_t key, uint32_t ch) {
+    if (key == 0) {
+        return ch < 128 ? 256 + (int) ch : -1;
+    } else if (key < 128) {
+        return key;
+    } else if (key > 0xffff - 128) {
+        return 128 + (0xffff - key);
+    }
+    return -1;
+}
+
+void keymap_init(Keymap *k); // Default bindings, already compiled
+
+// Parses a key combination like "ctrl+shift+left" or "alt+z"; returns 0 if
+// it's not valid
+int keymap_parse(char *combo, int *mod, int *slot);
+void keymap_bind(Keymap *k, int mod, int slot, Command cmd);
+
+// Fills in the unbound entries in the lookup table. Call after changing any
+// bindings
+void keymap_compile(Keymap *k);
+
+#endif
@@ -1,11 +1,27 @@
 
 #include "editor.h"
+#include "batch.h"
+#include "config.h"
 
 #define TB_IMPL
 #include <termbox.h>
 
 int main(int argc, char *argv[]) {
+    if (argc >= 2 && strcmp(argv[1], "--batch") == 0) {
+        return batch_main(argc - 2, argv + 2); // Doesn't need a terminal
+    }
+
+    static Config config; // Holds the keymap, so keep it off the stack
+    config_init(&config);
+    char config_file[1024];
+    int must_exist;
+    if (config_path(config_file, sizeof(config_file), &must_exist) &&
+        !config_load(&config, config_file, must_exist)) {
+        return 1; // Report errors before the terminal is taken over
+    }
+
     tb_init();
+    tb_set_input_mode(TB_INPUT_ALT | TB_INPUT_MOUSE);
 
     Editor editor;
     if (argc == 2) { // argv[0] is the executable name
@@ -13,12 +29,18 @@ int main(int argc, char *argv[]) {
     } else {
         editor = editor_new();
     }
+    config_apply(&config, &editor);
 
     editor_draw(&editor);
     while (editor.run) {
         struct tb_event ev;
         tb_poll_event(&ev);
         editor_update(&editor, ev);
+        // Handle everything that's queued up before redrawing, so e.g. fast
+        // mouse wheel scrolling only costs one redraw
+        while (editor.run && tb_peek_event(&ev, 0) == TB_OK) {
+            editor_update(&editor, ev);
+        }
         editor_draw(&editor);
     }
     tb_shutdown();